@@ -0,0 +1,104 @@
+/**
+ * @file      scanner_bench.cpp
+ * @brief     Compare the directive scanner with the old std::regex matching
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <regex>
+#include <sstream>
+#include <string>
+#include "../scanner.hpp"
+using namespace std;
+
+const regex regex_include { R"+(^\s*#\s*include\s*(<.*>|".*")\s*$)+" };
+const regex regex_system_include { R"+(^\s*#\s*include\s*<.*>\s*$)+" };
+
+struct result_t {
+	size_t includes = 0;
+	size_t angles	= 0;
+};
+
+// The way parse_include used to work
+result_t scan_regex(const string& text) {
+	result_t	  r;
+	istringstream sin(text);
+	string		  line;
+	while(!sin.eof()) {
+		getline(sin, line);
+		if(regex_match(line, regex_include)) {
+			++r.includes;
+			r.angles += regex_match(line, regex_system_include);
+		}
+	}
+	return r;
+}
+
+result_t scan_directive(const string& text) {
+	result_t r;
+	size_t	 scan = 0, begin;
+	while((begin = find_directive(text, scan)) != string::npos) {
+		size_t				end = find_line_end(text, begin);
+		include_directive_t inc;
+		if(match_include(string_view(text).substr(begin, end - begin), inc)) {
+			++r.includes;
+			r.angles += inc.is_angle;
+		}
+		scan = end + 1;
+	}
+	return r;
+}
+
+// A header-like input: mostly code and comments, a few directives
+string make_input(size_t lines) {
+	string text;
+	for(size_t i = 0; i < lines; ++i) {
+		switch(i % 16) {
+		case 0: text += "#include <vector>\n"; break;
+		case 1: text += "  #  include \"detail/impl_" + to_string(i) + ".h\"\n"; break;
+		case 2: text += "#define MACRO_" + to_string(i) + " 1\n"; break;
+		case 3: text += "// A comment mentioning #include <nothing>\n"; break;
+		default: text += "\tstatic inline int function_" + to_string(i) + "(int a, int b) { return a * b + " + to_string(i) + "; }\n"; break;
+		}
+	}
+	return text;
+}
+
+template<typename F>
+double measure(F&& f, const string& text, int rounds, result_t& r) {
+	auto start = chrono::steady_clock::now();
+	for(int i = 0; i < rounds; ++i) {
+		r = f(text);
+	}
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	string text;
+	if(argc > 1) { // Concatenate the given files
+		for(int i = 1; i < argc; ++i) {
+			ifstream fin(argv[i]);
+			text.append(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+		}
+	} else {
+		text = make_input(200000);
+	}
+	constexpr int rounds = 5;
+	result_t	  r1, r2;
+	double		  t1 = measure(scan_regex, text, rounds, r1);
+	double		  t2 = measure(scan_directive, text, rounds, r2);
+	double		  mb = double(text.size()) * rounds / (1 << 20);
+	cout << "Input: " << text.size() << " bytes, " << r1.includes << " includes (" << r1.angles << " angle)\n"
+		 << "regex:   " << t1 << " s (" << mb / t1 << " MiB/s)\n"
+		 << "scanner: " << t2 << " s (" << mb / t2 << " MiB/s)\n"
+		 << "speedup: " << t1 / t2 << "x" << endl;
+	if(r1.includes != r2.includes || r1.angles != r2.angles) {
+		cerr << "Error: scanner found " << r2.includes << " includes (" << r2.angles << " angle)" << endl;
+		return 1;
+	}
+	return 0;
+}
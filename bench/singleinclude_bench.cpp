@@ -0,0 +1,251 @@
+/**
+ * @file      singleinclude_bench.cpp
+ * @brief     Measure SingleInclude on a generated include tree, phase by phase
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "../singleinclude.hpp"
+using namespace std;
+namespace fs = filesystem;
+
+struct corpus_options_t {
+	size_t	 fanout	   = 4;	   // Includes per file
+	size_t	 depth	   = 5;	   // Levels below the root
+	size_t	 file_size = 4096; // Bytes of each file, includes excluded
+	size_t	 max_files = 2000;
+	double	 sharing   = 0.3; // Probability for an include to reuse a file of the next level (diamonds)
+	double	 system	   = 0.2; // Probability for an include to be a system header
+	unsigned seed	   = 1;
+};
+
+struct corpus_t {
+	fs::path root;		   // The file to amalgamate
+	fs::path include_path; // To be given with -I
+	size_t	 files	= 0;
+	size_t	 bytes	= 0;
+	size_t	 shared = 0; // Includes of a file which was created already
+	size_t	 system = 0;
+};
+
+constexpr const char* system_headers[] = { "vector", "string", "map", "memory", "algorithm", "cstdint", "utility", "functional" };
+
+// Code-like lines, with a comment mentioning a directive from time to time
+string make_filler(size_t size, size_t seed) {
+	string text;
+	for(size_t i = 0; text.size() < size; ++i) {
+		if(i % 8 == 7) {
+			text += "// Not a directive: #include <nothing.h>\n";
+		} else {
+			text += "static inline int f_" + to_string(seed) + "_" + to_string(i) + "(int a, int b) { return a * b + " + to_string(i) + "; }\n";
+		}
+	}
+	return text;
+}
+
+/**
+ * @brief Write a random include tree to dir/include, removing what was there
+ * @note  Level n holds the files included by level n - 1. An include either
+ *        names a system header, an existing file of the next level (which
+ *        makes diamonds) or a new one, until max_files is reached.
+ */
+corpus_t generate_corpus(const fs::path& dir, const corpus_options_t& opt) {
+	mt19937						 rng(opt.seed);
+	uniform_real_distribution<>	 chance(0.0, 1.0);
+	vector<vector<size_t>>		 levels(opt.depth + 1); // Indexes in files
+	vector<pair<string, string>> files;					// Name relative to the include path, includes
+	corpus_t					 corpus;
+	corpus.include_path = dir / "include";
+	fs::remove_all(corpus.include_path);
+	fs::create_directories(corpus.include_path);
+
+	levels[0].push_back(0);
+	files.emplace_back("root.h", "");
+	for(size_t level = 0; level < opt.depth; ++level) {
+		for(auto index : levels[level]) {
+			string includes;
+			for(size_t i = 0; i < opt.fanout; ++i) {
+				auto& next = levels[level + 1];
+				if(chance(rng) < opt.system) {
+					includes += "#include <" + string(system_headers[rng() % std::size(system_headers)]) + ">\n";
+					++corpus.system;
+				} else if(!next.empty() && (chance(rng) < opt.sharing || files.size() >= opt.max_files)) {
+					includes += "#include \"" + files[next[rng() % next.size()]].first + "\"\n";
+					++corpus.shared;
+				} else if(files.size() < opt.max_files) {
+					string child = "l" + to_string(level + 1) + "/f" + to_string(next.size()) + ".h";
+					next.push_back(files.size());
+					files.emplace_back(child, "");
+					includes += "#include \"" + child + "\"\n";
+				}
+			}
+			files[index].second = includes;
+		}
+	}
+	for(size_t i = 0; i < files.size(); ++i) {
+		auto& [name, includes] = files[i];
+		string	 text		   = "#pragma once\n" + includes + make_filler(opt.file_size, i);
+		fs::path path		   = corpus.include_path / name;
+		fs::create_directories(path.parent_path());
+		ofstream(path, ios::binary) << text;
+		corpus.bytes += text.size();
+	}
+	corpus.files = files.size();
+	corpus.root	 = corpus.include_path / "root.h";
+	return corpus;
+}
+
+struct phases_t {
+	double read	   = 0;
+	double scan	   = 0;
+	double resolve = 0;
+	double emit	   = 0; // Expansion alone, the other phases excluded
+	size_t output  = 0;
+	size_t probes  = 0;
+};
+
+template<typename F>
+double measure(F&& f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Amalgamate the whole tree with a new amalgamator, so every cache is cold, and collect the time of its phases
+phases_t run_phases(const corpus_t& corpus) {
+	amalgamator_t amalgamator;
+	result_t	  result;
+	amalgamator.includePaths.push_back(corpus.include_path);
+	amalgamator.stats.enabled = true;
+	if(auto error = amalgamator.amalgamate(corpus.root, result); error != E_NO_ERROR) {
+		cerr << "Error: " << error.what() << endl;
+		exit(1);
+	}
+	auto	 seconds = [&](phase_t p) { return double(amalgamator.stats.wall[p]) / 1e9; };
+	phases_t p;
+	p.read	  = seconds(P_READ);
+	p.scan	  = seconds(P_SCAN);
+	p.resolve = seconds(P_RESOLVE);
+	p.emit	  = seconds(P_EMIT);
+	p.output  = result.output.str().size();
+	p.probes  = amalgamator.resolver.probes;
+	return p;
+}
+
+void print_help(const char* progname) {
+	cout << "Usage: " << progname << " [options...]\n"
+		 << "Generate an include tree, then time each phase of the amalgamation and the whole program\n"
+		 << "Options:\n"
+		 << "  --fanout N\t\tIncludes per file (default 4)\n"
+		 << "  --depth N\t\tLevels below the root (default 5)\n"
+		 << "  --file-size N\t\tBytes of code in each file (default 4096)\n"
+		 << "  --max-files N\t\tStop creating files after N (default 2000)\n"
+		 << "  --sharing P\t\tProbability for an include to reuse a file, making diamonds (default 0.3)\n"
+		 << "  --system P\t\tProbability for an include to be a system header (default 0.2)\n"
+		 << "  --seed N\t\tSeed of the generator (default 1)\n"
+		 << "  --runs N\t\tNumber of runs, the best one is reported (default 5)\n"
+		 << "  --dir DIR\t\tWrite the tree to DIR/include and keep it, DIR/include is removed first (default: a temporary directory)\n"
+		 << "  --exe FILE\t\tsingleinclude executable to time end to end\n"
+		 << endl;
+}
+
+int main(int argc, char* argv[]) {
+	corpus_options_t opt;
+	int				 runs = 5;
+	fs::path		 dir;
+	bool			 keep = false;
+	string			 exe;
+#ifdef SINGLEINCLUDE_EXE
+	exe = SINGLEINCLUDE_EXE;
+#endif
+	for(int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if(arg == "-h" || arg == "--help") {
+			print_help(argv[0]);
+			return 0;
+		} else if(i + 1 == argc) {
+			cerr << "Error: Unkown option " << arg << endl;
+			return 1;
+		}
+		string value = argv[++i];
+		if(arg == "--fanout") {
+			opt.fanout = stoul(value);
+		} else if(arg == "--depth") {
+			opt.depth = stoul(value);
+		} else if(arg == "--file-size") {
+			opt.file_size = stoul(value);
+		} else if(arg == "--max-files") {
+			opt.max_files = stoul(value);
+		} else if(arg == "--sharing") {
+			opt.sharing = stod(value);
+		} else if(arg == "--system") {
+			opt.system = stod(value);
+		} else if(arg == "--seed") {
+			opt.seed = static_cast<unsigned>(stoul(value));
+		} else if(arg == "--runs") {
+			runs = max(stoi(value), 1);
+		} else if(arg == "--dir") {
+			dir	 = value;
+			keep = true;
+		} else if(arg == "--exe") {
+			exe = value;
+		} else {
+			cerr << "Error: Unkown option " << arg << endl;
+			return 1;
+		}
+	}
+	if(dir.empty()) {
+		dir = fs::temp_directory_path() / ("singleinclude_bench_" + to_string(random_device {}()));
+	}
+
+	corpus_t corpus;
+	double	 gen = measure([&] { corpus = generate_corpus(dir, opt); });
+	cout << "Corpus: " << corpus.files << " files, " << corpus.bytes << " bytes, " << corpus.shared << " shared includes, "
+		 << corpus.system << " system includes (generated in " << gen << " s)\n";
+
+	phases_t best;
+	for(int i = 0; i < runs; ++i) {
+		phases_t p = run_phases(corpus);
+		if(i == 0 || p.read + p.scan + p.resolve + p.emit < best.read + best.scan + best.resolve + best.emit) {
+			best = p;
+		}
+	}
+	double mb = double(corpus.bytes) / (1 << 20);
+	cout << "read:    " << best.read << " s\n"
+		 << "scan:    " << best.scan << " s (" << mb / best.scan << " MiB/s)\n"
+		 << "resolve: " << best.resolve << " s (" << best.probes << " files probed)\n"
+		 << "emit:    " << best.emit << " s (" << best.output << " bytes)\n";
+
+	if(!exe.empty() && fs::exists(exe)) {
+		fs::path out	 = dir / "out.hpp";
+		string	 command = "\"" + exe + "\" -I \"" + corpus.include_path.string() + "\" \"" + corpus.root.string() + "\" -o \"" + out.string() + "\"";
+		double	 total	 = 0;
+		for(int i = 0; i < runs; ++i) {
+			int	   status = 0;
+			double t	  = measure([&] { status = system(command.c_str()); });
+			if(status != 0) {
+				cerr << "Error: " << command << " failed" << endl;
+				return 1;
+			}
+			total = i == 0 ? t : min(total, t);
+		}
+		cout << "end to end: " << total << " s (" << fs::file_size(out) << " bytes)" << endl;
+	} else {
+		cout << "end to end: skipped, no executable given with --exe" << endl;
+	}
+	if(!keep) {
+		error_code ec;
+		fs::remove_all(dir, ec);
+	}
+	return 0;
+}
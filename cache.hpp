@@ -0,0 +1,318 @@
+/**
+ * @file      cache.hpp
+ * @brief     Persistent scan cache of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_CACHE_HPP
+#define SINGLEINCLUDE_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "reader.hpp"
+#include "scanner.hpp"
+
+// A directive stored by offsets, so it can point into a new read of the file
+struct cached_directive_t {
+	uint64_t		 begin;
+	uint64_t		 end;
+	uint64_t		 name_begin;
+	uint64_t		 name_size;
+	bool			 is_angle;
+	directive_kind_t kind;
+};
+
+struct cached_file_t {
+	file_id_t						id;
+	std::vector<cached_directive_t> directives;
+};
+
+// Modification time of a directory, or -1 if it is not a directory
+inline int64_t dir_stamp(const std::string& dir) {
+	std::error_code ec;
+	if(!std::filesystem::is_directory(dir, ec)) {
+		return -1;
+	}
+	auto t = std::filesystem::last_write_time(dir, ec);
+	return ec ? -1 : static_cast<int64_t>(t.time_since_epoch().count());
+}
+
+/**
+ * @brief What earlier runs found out, kept in one file between runs
+ * @note  A file is only trusted while its device, inode, size and mtime are
+ *        unchanged. The resolutions are only trusted with the same include
+ *        paths and while none of the directories they depend on has been
+ *        modified, which is how a new header shadowing an old one is noticed.
+ */
+class scan_cache_t {
+public:
+	static constexpr const char* file_name = "singleinclude.cache";
+
+	std::atomic<size_t> hits { 0 };
+	std::atomic<size_t> misses { 0 };
+
+	std::vector<std::string>										include_paths;
+	std::map<std::string, int64_t>									dirs; // Directory and its dir_stamp
+	std::vector<std::pair<std::string, std::optional<std::string>>> resolutions;
+
+	// Check whether the resolutions still hold for include_paths
+	bool resolutions_valid(const std::vector<std::string>& paths) const {
+		if(paths != include_paths) {
+			return false;
+		}
+		for(auto& [dir, stamp] : dirs) {
+			if(dir_stamp(dir) != stamp) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief  Get the directives of file from the cache
+	 * @return false if the file is not cached or has changed since
+	 */
+	bool find(const std::string& name, const source_file_t& file, std::vector<directive_line_t>& directives) {
+		std::string_view text = file.text();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto						it = files.find(name);
+			if(it != files.end() && file.id().valid() && it->second.id == file.id() && it->second.id.size == text.size()) {
+				directives.clear();
+				for(auto& d : it->second.directives) {
+					if(d.end > text.size() || d.name_begin + d.name_size > d.end) { // Corrupted
+						directives.clear();
+						break;
+					}
+					include_directive_t inc { text.substr(static_cast<size_t>(d.name_begin), static_cast<size_t>(d.name_size)), d.is_angle };
+					directives.push_back({ static_cast<size_t>(d.begin), static_cast<size_t>(d.end), d.kind, inc });
+				}
+				if(directives.size() == it->second.directives.size()) {
+					++hits;
+					return true;
+				}
+			}
+		}
+		++misses;
+		return false;
+	}
+
+	void store(const std::string& name, const source_file_t& file, const std::vector<directive_line_t>& directives) {
+		if(!file.id().valid()) {
+			return;
+		}
+		cached_file_t entry;
+		entry.id		 = file.id();
+		const char* base = file.text().data();
+		for(auto& [begin, end, kind, inc] : directives) {
+			entry.directives.push_back({ begin, end, static_cast<uint64_t>(inc.name.data() - base), inc.name.size(), inc.is_angle, kind });
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		files[name] = std::move(entry);
+	}
+
+	// Read the cache written by save() in place of what is held, return false and stay empty if it is missing or broken
+	bool load(const std::filesystem::path& path) {
+		include_paths.clear(); // Replaced, not merged with what an earlier load gave
+		dirs.clear();
+		resolutions.clear();
+		files.clear();
+		std::ifstream fin(path, std::ios::binary);
+		if(!fin.is_open()) {
+			return false;
+		}
+		data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+		pos		= 0;
+		bool ok = parse();
+		data.clear();
+		if(!ok) {
+			include_paths.clear();
+			dirs.clear();
+			resolutions.clear();
+			files.clear();
+		}
+		return ok;
+	}
+
+	// Write the cache to a temporary file, then rename it over path
+	bool save(const std::filesystem::path& path) {
+		data.clear();
+		data.append(magic);
+		put(static_cast<uint64_t>(include_paths.size()));
+		for(auto& p : include_paths) {
+			put(p);
+		}
+		put(static_cast<uint64_t>(dirs.size()));
+		for(auto& [dir, stamp] : dirs) {
+			put(dir);
+			put(static_cast<uint64_t>(stamp));
+		}
+		put(static_cast<uint64_t>(resolutions.size()));
+		for(auto& [key, result] : resolutions) {
+			put(key);
+			put(result.has_value());
+			put(result ? *result : std::string());
+		}
+		put(static_cast<uint64_t>(files.size()));
+		for(auto& [name, f] : files) {
+			put(name);
+			put(f.id.dev);
+			put(f.id.ino);
+			put(f.id.size);
+			put(static_cast<uint64_t>(f.id.mtime_ns));
+			put(static_cast<uint64_t>(f.directives.size()));
+			for(auto& d : f.directives) {
+				put(d.begin);
+				put(d.end);
+				put(d.name_begin);
+				put(d.name_size);
+				put(d.is_angle);
+				put(static_cast<uint64_t>(d.kind));
+			}
+		}
+		auto temp = path;
+		temp += ".tmp";
+		{
+			std::ofstream fout(temp, std::ios::binary | std::ios::trunc);
+			fout.write(data.data(), static_cast<std::streamsize>(data.size()));
+			if(!fout.good()) {
+				data.clear();
+				return false;
+			}
+		}
+		data.clear();
+		std::error_code ec;
+		std::filesystem::rename(temp, path, ec);
+		return !ec;
+	}
+
+private:
+	static constexpr std::string_view magic = "SICACHE3";
+
+	std::map<std::string, cached_file_t> files;
+	std::mutex							 mutex;
+	std::string							 data; // Serialized cache while loading or saving
+	size_t								 pos = 0;
+
+	void put(uint64_t v) {
+		data.append(reinterpret_cast<const char*>(&v), sizeof(v));
+	}
+
+	void put(bool b) {
+		data += static_cast<char>(b);
+	}
+
+	void put(const std::string& s) {
+		put(static_cast<uint64_t>(s.size()));
+		data += s;
+	}
+
+	bool get(uint64_t& v) {
+		if(data.size() - pos < sizeof(v)) {
+			return false;
+		}
+		std::memcpy(&v, data.data() + pos, sizeof(v));
+		pos += sizeof(v);
+		return true;
+	}
+
+	bool get(int64_t& v) {
+		uint64_t u;
+		if(!get(u)) {
+			return false;
+		}
+		v = static_cast<int64_t>(u);
+		return true;
+	}
+
+	bool get(bool& b) {
+		if(pos == data.size()) {
+			return false;
+		}
+		b = data[pos++] != 0;
+		return true;
+	}
+
+	bool get(std::string& s) {
+		uint64_t size;
+		if(!get(size) || data.size() - pos < size) {
+			return false;
+		}
+		s.assign(data, pos, size);
+		pos += size;
+		return true;
+	}
+
+	bool parse() {
+		if(data.compare(0, magic.size(), magic) != 0) {
+			return false;
+		}
+		pos = magic.size();
+		uint64_t n;
+		if(!get(n)) {
+			return false;
+		}
+		for(; n; --n) {
+			if(!get(include_paths.emplace_back())) {
+				return false;
+			}
+		}
+		if(!get(n)) {
+			return false;
+		}
+		for(; n; --n) {
+			std::string dir;
+			int64_t		stamp;
+			if(!get(dir) || !get(stamp)) {
+				return false;
+			}
+			dirs.emplace(std::move(dir), stamp);
+		}
+		if(!get(n)) {
+			return false;
+		}
+		for(; n; --n) {
+			std::string key, result;
+			bool		found;
+			if(!get(key) || !get(found) || !get(result)) {
+				return false;
+			}
+			resolutions.emplace_back(std::move(key), found ? std::optional<std::string>(std::move(result)) : std::nullopt);
+		}
+		if(!get(n)) {
+			return false;
+		}
+		for(; n; --n) {
+			std::string	  name;
+			cached_file_t f;
+			uint64_t	  count;
+			if(!get(name) || !get(f.id.dev) || !get(f.id.ino) || !get(f.id.size) || !get(f.id.mtime_ns) || !get(count)) {
+				return false;
+			}
+			for(; count; --count) {
+				auto&	 d = f.directives.emplace_back();
+				uint64_t kind;
+				if(!get(d.begin) || !get(d.end) || !get(d.name_begin) || !get(d.name_size) || !get(d.is_angle) || !get(kind) || kind == D_NONE || kind > D_PRAGMA) {
+					return false;
+				}
+				d.kind = static_cast<directive_kind_t>(kind);
+			}
+			files.emplace(std::move(name), std::move(f));
+		}
+		return pos == data.size();
+	}
+};
+
+#endif // SINGLEINCLUDE_CACHE_HPP
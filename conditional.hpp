@@ -0,0 +1,474 @@
+/**
+ * @file      conditional.hpp
+ * @brief     Conditional compilation evaluator of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_CONDITIONAL_HPP
+#define SINGLEINCLUDE_CONDITIONAL_HPP
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "scanner.hpp"
+
+using condition_t = std::optional<int64_t>; // std::nullopt if it cannot be decided
+
+// A macro given by -D or -U
+struct macro_t {
+	bool		defined = false;
+	condition_t value; // Unknown unless defined to an integer
+};
+
+// Parse an integer literal such as 42, 0x2A or 052L, signed values only
+inline condition_t parse_integer(std::string_view s) {
+	if(s.empty() || s[0] < '0' || s[0] > '9') {
+		return std::nullopt;
+	}
+	int		 base = 10;
+	size_t	 i	  = 0;
+	uint64_t v	  = 0;
+	if(s.size() > 1 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+		base = 16;
+		i	 = 2;
+	} else if(s[0] == '0') {
+		base = 8;
+	}
+	size_t digits = i;
+	for(; i < s.size(); ++i) {
+		char c = s[i];
+		int	 d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 99;
+		if(d >= base) {
+			break;
+		}
+		if(v > (uint64_t(INT64_MAX) - d) / base) { // Overflow
+			return std::nullopt;
+		}
+		v = v * base + d;
+	}
+	if(i == digits) {
+		return std::nullopt;
+	}
+	for(; i < s.size(); ++i) { // Unsigned values compare differently, so they are not decided
+		if(s[i] != 'l' && s[i] != 'L') {
+			return std::nullopt;
+		}
+	}
+	return static_cast<int64_t>(v);
+}
+
+/**
+ * @brief What is known about macros while a target is expanded
+ * @note  Only the macros given by -D and -U are known, any other identifier
+ *        cannot be decided as the headers may define it. A macro defined or
+ *        undefined by a header is unknown from then on.
+ */
+class macro_table_t {
+public:
+	// Whether any macro has been given, the evaluator is only used then
+	bool enabled() const {
+		return used;
+	}
+
+	// Add NAME or NAME=VALUE, as given to -D
+	void define(std::string_view def) {
+		size_t			 eq	   = def.find('=');
+		std::string_view value = eq == std::string_view::npos ? "1" : def.substr(eq + 1);
+		macros[std::string(def.substr(0, eq))] = { true, parse_integer(value) };
+		used								   = true;
+	}
+
+	void undefine(std::string_view name) {
+		macros[std::string(name)] = { false, std::nullopt };
+		used					  = true;
+	}
+
+	// A header defines or undefines name
+	void forget(std::string_view name) {
+		if(auto it = macros.find(name); it != macros.end()) {
+			macros.erase(it);
+		}
+	}
+
+	// Whether name is defined, std::nullopt if unknown
+	std::optional<bool> defined(std::string_view name) const {
+		if(auto it = macros.find(name); it != macros.end()) {
+			return it->second.defined;
+		}
+		return std::nullopt;
+	}
+
+	// Evaluate the expression of #if or #elif
+	condition_t evaluate(std::string_view expr) const {
+		expression_t e { *this, expr };
+		condition_t	 v = e.conditional();
+		e.skip_space();
+		return e.failed || e.pos != expr.size() ? std::nullopt : v;
+	}
+
+private:
+	std::map<std::string, macro_t, std::less<>> macros;
+	bool										 used = false;
+
+	// Recursive descent over the grammar of #if, each level of precedence by one function
+	struct expression_t {
+		const macro_table_t& table;
+		std::string_view	 s;
+		size_t				 pos	= 0;
+		bool				 failed = false; // Not understood
+
+		void skip_space() {
+			while(pos < s.size()) {
+				if(is_space(s[pos])) {
+					++pos;
+				} else if(s.compare(pos, 2, "//") == 0) {
+					pos = s.size();
+				} else if(s.compare(pos, 2, "/*") == 0) {
+					size_t end = s.find("*/", pos + 2);
+					pos		   = end == std::string_view::npos ? s.size() : end + 2;
+				} else {
+					break;
+				}
+			}
+		}
+
+		// Consume op if it is next and not the start of a longer operator in others
+		bool accept(std::string_view op, std::string_view others = "") {
+			skip_space();
+			if(s.compare(pos, op.size(), op) != 0) {
+				return false;
+			}
+			if(pos + op.size() < s.size() && others.find(s[pos + op.size()]) != std::string_view::npos) {
+				return false;
+			}
+			pos += op.size();
+			return true;
+		}
+
+		std::string_view identifier() {
+			skip_space();
+			size_t begin = pos;
+			if(pos < s.size() && is_identifier(s[pos]) && !(s[pos] >= '0' && s[pos] <= '9')) {
+				while(pos < s.size() && is_identifier(s[pos])) {
+					++pos;
+				}
+			}
+			return s.substr(begin, pos - begin);
+		}
+
+		condition_t primary() {
+			skip_space();
+			if(pos == s.size()) {
+				failed = true;
+				return std::nullopt;
+			}
+			if(accept("(")) {
+				condition_t v = conditional();
+				if(!accept(")")) {
+					failed = true;
+				}
+				return v;
+			}
+			if(s[pos] >= '0' && s[pos] <= '9') {
+				size_t begin = pos;
+				while(pos < s.size() && is_identifier(s[pos])) {
+					++pos;
+				}
+				return parse_integer(s.substr(begin, pos - begin));
+			}
+			std::string_view name = identifier();
+			if(name.empty()) { // Character literals and anything else
+				failed = true;
+				return std::nullopt;
+			}
+			if(name == "defined") {
+				bool			 paren	 = accept("(");
+				std::string_view operand = identifier();
+				if(operand.empty() || (paren && !accept(")"))) {
+					failed = true;
+					return std::nullopt;
+				}
+				auto d = table.defined(operand);
+				return d ? condition_t(*d) : std::nullopt;
+			}
+			skip_space();
+			if(pos < s.size() && s[pos] == '(') { // A function-like macro, or __has_include
+				failed = true;
+				return std::nullopt;
+			}
+			if(auto it = table.macros.find(name); it != table.macros.end()) {
+				return it->second.defined ? it->second.value : condition_t(0);
+			}
+			return std::nullopt;
+		}
+
+		condition_t unary() {
+			if(accept("!", "=")) {
+				condition_t v = unary();
+				return v ? condition_t(!*v) : std::nullopt;
+			} else if(accept("~")) {
+				condition_t v = unary();
+				return v ? condition_t(~*v) : std::nullopt;
+			} else if(accept("-")) {
+				condition_t v = unary();
+				return v ? condition_t(static_cast<int64_t>(0 - static_cast<uint64_t>(*v))) : std::nullopt;
+			} else if(accept("+")) {
+				return unary();
+			}
+			return primary();
+		}
+
+		// Parse a left-associative level: operand (op operand)*
+		template<typename Next, typename Apply>
+		condition_t binary(Next next, std::initializer_list<std::pair<std::string_view, std::string_view>> ops, Apply apply) {
+			condition_t left = (this->*next)();
+			while(!failed) {
+				bool matched = false;
+				for(auto& [op, others] : ops) {
+					if(accept(op, others)) {
+						condition_t right = (this->*next)();
+						left			  = left && right ? apply(op, *left, *right) : std::nullopt;
+						matched			  = true;
+						break;
+					}
+				}
+				if(!matched) {
+					break;
+				}
+			}
+			return left;
+		}
+
+		condition_t multiplicative() {
+			return binary(&expression_t::unary, { { "*", "=" }, { "/", "=" }, { "%", "=" } }, [](std::string_view op, int64_t a, int64_t b) -> condition_t {
+				if(op == "*") {
+					return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+				} else if(b == 0 || (a == INT64_MIN && b == -1)) {
+					return std::nullopt;
+				}
+				return op == "/" ? a / b : a % b;
+			});
+		}
+
+		condition_t additive() {
+			return binary(&expression_t::multiplicative, { { "+", "=" }, { "-", "=" } }, [](std::string_view op, int64_t a, int64_t b) -> condition_t {
+				uint64_t ua = static_cast<uint64_t>(a), ub = static_cast<uint64_t>(b); // Wrap around instead of overflowing
+				return static_cast<int64_t>(op == "+" ? ua + ub : ua - ub);
+			});
+		}
+
+		condition_t shift() {
+			return binary(&expression_t::additive, { { "<<", "=" }, { ">>", "=" } }, [](std::string_view op, int64_t a, int64_t b) -> condition_t {
+				if(b < 0 || b >= 64) {
+					return std::nullopt;
+				}
+				return op == "<<" ? a << b : a >> b;
+			});
+		}
+
+		condition_t relational() {
+			return binary(&expression_t::shift, { { "<=", "" }, { ">=", "" }, { "<", "<=" }, { ">", ">=" } }, [](std::string_view op, int64_t a, int64_t b) -> condition_t {
+				return op == "<=" ? a <= b : op == ">=" ? a >= b : op == "<" ? a < b : a > b;
+			});
+		}
+
+		condition_t equality() {
+			return binary(&expression_t::relational, { { "==", "" }, { "!=", "" } }, [](std::string_view op, int64_t a, int64_t b) -> condition_t {
+				return op == "==" ? a == b : a != b;
+			});
+		}
+
+		condition_t bit_and() {
+			return binary(&expression_t::equality, { { "&", "&=" } }, [](std::string_view, int64_t a, int64_t b) -> condition_t { return a & b; });
+		}
+
+		condition_t bit_xor() {
+			return binary(&expression_t::bit_and, { { "^", "=" } }, [](std::string_view, int64_t a, int64_t b) -> condition_t { return a ^ b; });
+		}
+
+		condition_t bit_or() {
+			return binary(&expression_t::bit_xor, { { "|", "|=" } }, [](std::string_view, int64_t a, int64_t b) -> condition_t { return a | b; });
+		}
+
+		// A known false operand decides &&, even if the other one is unknown
+		condition_t logical_and() {
+			condition_t left = bit_or();
+			while(!failed && accept("&&")) {
+				condition_t right = bit_or();
+				if((left && !*left) || (right && !*right)) {
+					left = 0;
+				} else {
+					left = left && right ? condition_t(1) : std::nullopt;
+				}
+			}
+			return left;
+		}
+
+		condition_t logical_or() {
+			condition_t left = logical_and();
+			while(!failed && accept("||")) {
+				condition_t right = logical_and();
+				if((left && *left) || (right && *right)) {
+					left = 1;
+				} else {
+					left = left && right ? condition_t(0) : std::nullopt;
+				}
+			}
+			return left;
+		}
+
+		condition_t conditional() {
+			condition_t c = logical_or();
+			if(failed || !accept("?")) {
+				return c;
+			}
+			condition_t a = conditional();
+			if(!accept(":")) {
+				failed = true;
+				return std::nullopt;
+			}
+			condition_t b = conditional();
+			if(!c) {
+				return a && b && *a == *b ? a : std::nullopt;
+			}
+			return *c ? a : b;
+		}
+	};
+};
+
+// What to do with the line of a directive, see branch_stack_t::step
+enum branch_action_t {
+	B_KEEP,	  // Leave the line in the output
+	B_DROP,	  // Remove the line
+	B_REOPEN, // Remove the line, then open the conditional again with #if, #ifdef or #ifndef
+};
+
+/**
+ * @brief Conditionals of one file, pruning the branches which are decided
+ * @note  A conditional whose first condition cannot be decided is kept as
+ *        it is, as well as everything following an undecided #elif. When
+ *        the branches before such an #elif have been dropped, it opens the
+ *        conditional again. Conditionals nested in a dropped branch are
+ *        dropped with it.
+ */
+class branch_stack_t {
+public:
+	// Whether the text at this point is part of the output
+	bool live() const {
+		return dead == 0;
+	}
+
+	// Update the state for a directive found while expanding
+	branch_action_t step(directive_kind_t kind, std::string_view arg, macro_table_t& macros) {
+		switch(kind) {
+		case D_IF:
+		case D_IFDEF:
+		case D_IFNDEF: {
+			if(!live()) {
+				push(C_DEAD);
+				return B_DROP;
+			}
+			condition_t c = condition(kind, arg, macros);
+			push(!c ? C_KEEP : *c ? C_TRUE : C_PENDING);
+			return c ? B_DROP : B_KEEP;
+		}
+		case D_ELIF:
+		case D_ELIFDEF:
+		case D_ELIFNDEF: {
+			if(chains.empty() || chains.back() == C_KEEP) {
+				return B_KEEP;
+			} else if(chains.back() == C_TRUE) {
+				set(C_DONE);
+			} else if(chains.back() == C_PENDING) {
+				condition_t c = condition(kind, arg, macros);
+				if(!c) {
+					set(C_KEEP);
+					return B_REOPEN;
+				} else if(*c) {
+					set(C_TRUE);
+				}
+			}
+			return B_DROP;
+		}
+		case D_ELSE: {
+			if(chains.empty() || chains.back() == C_KEEP) {
+				return B_KEEP;
+			} else if(chains.back() == C_TRUE) {
+				set(C_DONE);
+			} else if(chains.back() == C_PENDING) {
+				set(C_TRUE);
+			}
+			return B_DROP;
+		}
+		case D_ENDIF: {
+			if(chains.empty()) { // Not opened in this file
+				return B_KEEP;
+			}
+			chain_t c = chains.back();
+			dead -= is_dead(c);
+			chains.pop_back();
+			return c == C_KEEP ? B_KEEP : B_DROP;
+		}
+		case D_DEFINE:
+		case D_UNDEF: {
+			if(live()) {
+				macros.forget(leading_identifier(arg));
+			}
+			return B_KEEP;
+		}
+		default: {
+			return B_KEEP;
+		}
+		}
+	}
+
+private:
+	enum chain_t : uint8_t {
+		C_KEEP,	   // Undecided, kept as it is
+		C_TRUE,	   // In the branch which is taken
+		C_PENDING, // No branch taken yet, the current one is dropped
+		C_DONE,	   // A branch has been taken, the current one is dropped
+		C_DEAD,	   // Nested in a dropped branch
+	};
+
+	std::vector<chain_t> chains;
+	size_t				 dead = 0; // Number of chains in a dropped branch
+
+	static bool is_dead(chain_t c) {
+		return c == C_PENDING || c == C_DONE || c == C_DEAD;
+	}
+
+	void push(chain_t c) {
+		chains.push_back(c);
+		dead += is_dead(c);
+	}
+
+	void set(chain_t c) {
+		dead -= is_dead(chains.back());
+		chains.back() = c;
+		dead += is_dead(c);
+	}
+
+	static condition_t condition(directive_kind_t kind, std::string_view arg, const macro_table_t& macros) {
+		if(!arg.empty() && arg.back() == '\\') { // Continued on the next line, which would be left alone
+			return std::nullopt;
+		}
+		if(kind == D_IF || kind == D_ELIF) {
+			return macros.evaluate(arg);
+		}
+		std::string_view name = sole_identifier(arg);
+		auto			 d	  = name.empty() ? std::nullopt : macros.defined(name);
+		if(!d) {
+			return std::nullopt;
+		}
+		return (kind == D_IFDEF || kind == D_ELIFDEF) == *d;
+	}
+};
+
+#endif // SINGLEINCLUDE_CONDITIONAL_HPP
@@ -0,0 +1,131 @@
+/**
+ * @file      graph.hpp
+ * @brief     Include graph of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_GRAPH_HPP
+#define SINGLEINCLUDE_GRAPH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "paths.hpp"
+
+enum include_state_t {
+	I_EXPENDED,
+	I_ALREADY_INCLUDED,
+	I_NOT_FOUND,
+	INCLUDE_STATE_COUNT,
+};
+
+constexpr uint32_t first_expansion = UINT32_MAX;
+
+// One include directive, from the file expanding it to the file it names
+struct edge_t {
+	uint32_t		node;
+	include_state_t state;
+	bool			is_angle;					 // Form of the directive
+	uint32_t		expansion = first_expansion; // Expansion of node giving its children, with I_EXPENDED
+};
+
+/**
+ * @brief One file of the graph
+ * @note  The directory of a file is searched for its includes unless it was
+ *        included with <>, which may give different children. So a file
+ *        included in both forms is two nodes.
+ */
+struct node_t {
+	path_id_t name;
+	bool	  is_angle	= false; // Found by an angle include, or not found at all
+	bool	  expanded	= false; // Edges are set
+	uint32_t  expansion = 0;	 // The first one, if expanded
+};
+
+/**
+ * @brief Include graph of one target, every node stored once
+ * @note  The edges of a node are those of its first expansion. With --all,
+ *        a file expanded again may give other edges, as include guards and
+ *        macros may have changed since: they are kept as another expansion,
+ *        which the edge expanding it refers to. Node 0 is the root.
+ */
+class include_graph_t {
+public:
+	struct edge_range_t {
+		const edge_t* first;
+		const edge_t* last;
+
+		const edge_t* begin() const {
+			return first;
+		}
+		const edge_t* end() const {
+			return last;
+		}
+	};
+
+	// Get the id of the node of name, creating it if needed
+	uint32_t intern(path_id_t name, bool is_angle, bool found = true) {
+		uint64_t key		= uint64_t(name) << 2 | (found ? 1 + is_angle : 0);
+		auto [it, inserted] = ids.try_emplace(key, static_cast<uint32_t>(nodes.size()));
+		if(inserted) {
+			auto& n	   = nodes.emplace_back();
+			n.name	   = name;
+			n.is_angle = !found || is_angle;
+		}
+		return it->second;
+	}
+
+	const node_t& node(uint32_t id) const {
+		return nodes[id];
+	}
+
+	// Add the edges given by one expansion of id, return the expansion to refer to
+	uint32_t add_expansion(uint32_t id, const std::vector<edge_t>& e) {
+		auto& n = nodes[id];
+		if(n.expanded && std::equal(e.begin(), e.end(), edges(id).begin(), edges(id).end(), same_edge)) {
+			return first_expansion;
+		}
+		expansions.push_back({ static_cast<uint32_t>(edge_list.size()), static_cast<uint32_t>(e.size()) });
+		edge_list.insert(edge_list.end(), e.begin(), e.end());
+		if(!n.expanded) {
+			n.expanded	= true;
+			n.expansion = static_cast<uint32_t>(expansions.size() - 1);
+			return first_expansion;
+		}
+		return static_cast<uint32_t>(expansions.size() - 1);
+	}
+
+	// Edges of the first expansion of id
+	edge_range_t edges(uint32_t id) const {
+		return nodes[id].expanded ? range(nodes[id].expansion) : edge_range_t { nullptr, nullptr };
+	}
+
+	// Edges of the expansion e leads to
+	edge_range_t children(const edge_t& e) const {
+		return e.expansion == first_expansion ? edges(e.node) : range(e.expansion);
+	}
+
+	size_t size() const {
+		return nodes.size();
+	}
+
+private:
+	std::vector<node_t>						   nodes;
+	std::vector<edge_t>						   edge_list;  // Edges of each expansion are contiguous
+	std::vector<std::pair<uint32_t, uint32_t>> expansions; // First edge and number of edges
+	std::unordered_map<uint64_t, uint32_t>	   ids;
+
+	edge_range_t range(uint32_t expansion) const {
+		auto [first, count] = expansions[expansion];
+		return { edge_list.data() + first, edge_list.data() + first + count };
+	}
+
+	static bool same_edge(const edge_t& a, const edge_t& b) {
+		return a.node == b.node && a.state == b.state && a.is_angle == b.is_angle && a.expansion == b.expansion;
+	}
+};
+
+#endif // SINGLEINCLUDE_GRAPH_HPP
@@ -1,204 +1,301 @@
 /**
  * @file      main.cpp
- * @brief     Main source file of SingleInclude
+ * @brief     Command line of SingleInclude
  * @version   1.1
  * @author    dragon-archer (dragon-archer@outlook.com)
  * @copyright Copyright (c) 2022
  */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <map>
-#include <regex>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
-
-#if __has_include(<format.h>) // Provided by CMake
-#define FMT_HEADER_ONLY
-#include <format.h>
-using fmt::make_format_args;
-using fmt::vformat;
-#elif __has_include(<format>)
-#include <format>
-#elif __has_include(<fmt/format.h>)
-#define FMT_HEADER_ONLY
-#include <fmt/format.h>
-using fmt::make_format_args;
-using fmt::vformat;
-#else
-#error SingleInclude must be compiled with eithor <format> in std library or an external fmtlib
-#endif
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "server.hpp"
+#include "singleinclude.hpp"
 using namespace std;
 namespace fs = filesystem;
 
-enum error_type : int {
-	E_NO_ERROR = 0,
-	E_TOO_LESS_ARGUMENTS,
-	E_FILE_NOT_EXIST,
-	E_DIR_NOT_EXIST,
-	E_UNKNOWN_OPTION,
-	E_TOO_MANY_INPUT,
-	E_FILE_ERROR,
-	E_FINISH,
-	ERROR_COUNT
-};
-
-constexpr const char* error_msg[ERROR_COUNT] = {
-	"No error occured",
-	"Too less arguments",
-	"{}: File doesn't exist",
-	"{}: Directory doesn't exist",
-	"Unkown option {}",
-	"Too many input file",
-	"File error: {}",
-	"Finished"
-};
-
 enum option_t : int {
 	O_INCLUDE_ALL,
+	O_CACHE_DIR,
+	O_DEFINE,
+	O_DEPFILE,
+	O_DIR_INDEX,
 	O_DRY,
+	O_GROUP,
 	O_HELP,
+	O_HOIST,
 	O_INCLUDE_PATH,
+	O_JOBS,
+	O_KEEP_COMMENT,
+	O_MAKE_DEPS,
+	O_NO_HOIST,
 	O_OUT,
+	O_PREFETCH,
+	O_SHARDS,
+	O_STATS,
+	O_STREAM,
+	O_STRIP_COMMENTS,
+	O_TRACE,
 	O_TREE,
+	O_UNDEFINE,
+	O_UNITY,
 	O_VERBOSE,
+	O_WRITE_IF_CHANGED,
 	OPTION_COUNT
 };
 
 const map<char, option_t> short_options = {
 	make_pair('a', O_INCLUDE_ALL),
+	make_pair('D', O_DEFINE),
 	make_pair('d', O_DRY),
 	make_pair('h', O_HELP),
 	make_pair('I', O_INCLUDE_PATH),
+	make_pair('M', O_MAKE_DEPS),
+	make_pair('j', O_JOBS),
 	make_pair('o', O_OUT),
 	make_pair('t', O_TREE),
+	make_pair('U', O_UNDEFINE),
 	make_pair('v', O_VERBOSE)
 };
 
 const map<string, option_t> long_options = {
 	make_pair("all", O_INCLUDE_ALL),
+	make_pair("cache-dir", O_CACHE_DIR),
+	make_pair("define", O_DEFINE),
+	make_pair("depfile", O_DEPFILE),
+	make_pair("dir-index", O_DIR_INDEX),
 	make_pair("dry", O_DRY),
+	make_pair("group", O_GROUP),
 	make_pair("help", O_HELP),
+	make_pair("hoist", O_HOIST),
 	make_pair("include", O_INCLUDE_PATH),
+	make_pair("jobs", O_JOBS),
+	make_pair("keep-comment", O_KEEP_COMMENT),
+	make_pair("no-hoist", O_NO_HOIST),
 	make_pair("out", O_OUT),
+	make_pair("prefetch", O_PREFETCH),
+	make_pair("shards", O_SHARDS),
+	make_pair("stats", O_STATS),
+	make_pair("stream", O_STREAM),
+	make_pair("strip-comments", O_STRIP_COMMENTS),
+	make_pair("trace", O_TRACE),
 	make_pair("tree", O_TREE),
-	make_pair("verbose", O_VERBOSE)
-};
-
-const regex	 regex_include { R"+(^\s*#\s*include\s*(<.*>|".*")\s*$)+" };
-const regex	 regex_system_include { R"+(^\s*#\s*include\s*<.*>\s*$)+" };
-const string header = R"+(// This file is generated automatically by SingleInclude
-// It's suggested not to edit anything below
-// If you found any issue, please report to https://github.com/dragon-archer/SingleInclude/issues
-)+";
-
-string progname;
-bool   include_all = false;
-bool   verbose	   = false;
-bool   tree		   = false;
-bool   dry_run	   = false;
-
-struct error_state {
-	error_type e;
-	string	   w;
-	error_state(error_type error = E_NO_ERROR, string what = "")
-		: e(error)
-		, w(what) { }
-
-	operator error_type() {
-		return e;
-	}
-
-	string what() {
-		return "Error: " + vformat(error_msg[e], make_format_args(w));
-	}
-};
-
-enum include_state_t {
-	I_EXPENDED,
-	I_ALREADY_INCLUDED,
-	I_NOT_FOUND,
-	INCLUDE_STATE_COUNT,
-};
-
-constexpr const char* include_msg[INCLUDE_STATE_COUNT] = {
-	"expended",
-	"already included",
-	"not found"
+	make_pair("undefine", O_UNDEFINE),
+	make_pair("unity", O_UNITY),
+	make_pair("verbose", O_VERBOSE),
+	make_pair("write-if-changed", O_WRITE_IF_CHANGED)
 };
 
-struct file_t {
-	fs::path		name;
-	list<file_t>	includeFiles;
-	include_state_t state	 = I_EXPENDED;
-	bool			is_angle = false;
-
-	file_t(fs::path p = "", include_state_t istate = I_EXPENDED)
-		: name(p)
-		, state(istate) { }
-
-	operator fs::path() {
-		return name;
-	}
+// Options which take no value, so --name=value is an error
+const set<option_t> flag_options = {
+	O_INCLUDE_ALL,
+	O_DIR_INDEX,
+	O_DRY,
+	O_HELP,
+	O_HOIST,
+	O_STREAM,
+	O_STRIP_COMMENTS,
+	O_TREE,
+	O_VERBOSE,
+	O_WRITE_IF_CHANGED
 };
 
-struct state_t {
-	error_state	   error;
-	file_t		   file;
-	fs::path	   outfilename;
-	list<fs::path> includePaths;
-	set<fs::path>  includedFiles;
-
-	state_t(error_state e = E_NO_ERROR)
-		: error(e) { }
+// What the command line gives besides the options of the amalgamator
+struct command_line_t {
+	list<fs::path> outfilenames; // The n-th is the output of the n-th input
+	list<string>   groups;		 // The n-th is the group of the n-th input, with --unity
+	string		   group;		 // Given by the last --group
+	fs::path	   depFile;		 // Dependency file shared by all outputs
+	bool		   depPerOutput = false; // Write OUT.d beside each output
 };
 
-void log(string msg) {
-	if(verbose) {
-		cerr << msg << endl;
-	}
-}
-
-string add_quote(string name, bool is_angle) {
-	constexpr const char* begin_quote[2] = { "\"", "<" };
-	constexpr const char* end_quote[2]	 = { "\"", ">" };
-
-	return begin_quote[is_angle] + name + end_quote[is_angle];
-}
+string		   progname;
+bool		   tree		  = false;
+bool		   stats_json = false;
+command_line_t cli;
 
 void print_help() {
 	cout << "SingleInclude: A small program to generate a single include file for C/C++\n"
-		 << "Usage: " << progname << " [options...] FILE\n"
+		 << "Usage: " << progname << " [options...] FILE...\n"
+		 << "       " << progname << " --server SOCKET\n"
+		 << "       " << progname << " --connect SOCKET [options...] FILE...\n"
 		 << "Options:\n"
 		 << "  -a, --all\t\tExpend all files found, no matter whether it has been expended before\n"
 		 << "\t\t\tBy default, if one file has been expended before, it will be omitted later\n"
 		 << "\t\t\tThis may be helpful if you use macro to choose which file to include,\n"
-		 << "\t\t\tas this program cannot understand macro now\n"
+		 << "\t\t\tas this program only understands the macros given by -D and -U\n"
+		 << "\t\t\tFiles with #pragma once, or an include guard which is still defined,\n"
+		 << "\t\t\tare omitted all the same, as they would be empty\n"
+		 << "\t\t\tA file only expended inside conditionals is not omitted outside of them,\n"
+		 << "\t\t\tas they may be left out. With #pragma once but no include guard,\n"
+		 << "\t\t\tit then appears twice when those conditionals hold\n"
+		 << "      --cache-dir DIR\tKeep what has been scanned and resolved in DIR for the next runs\n"
+		 << "\t\t\tUnchanged files are then read once but not scanned again\n"
+		 << "      --connect SOCKET\tHave the server listening on SOCKET run the rest of the command line,\n"
+		 << "\t\t\twith the same output. Without a server, it is run here\n"
 		 << "  -d, --dry\t\tDry run mode, do not output the header file\n"
+		 << "  -D, --define NAME[=VALUE]\n"
+		 << "\t\t\tTake NAME as defined to VALUE (1 by default) in conditional directives,\n"
+		 << "\t\t\tand drop the branches which are then decided. Conditionals using\n"
+		 << "\t\t\tother macros are kept, as nothing is assumed about them\n"
+		 << "  -MD\t\t\tWrite a Makefile dependency file named OUT.d for each output OUT\n"
+		 << "  -MF, --depfile FILE\tWrite a Makefile dependency file of all outputs to FILE\n"
+		 << "\t\t\tBoth work with --dry, the outputs being still named by -o\n"
+		 << "      --dir-index\tList each searched directory once and look up include files in memory\n"
+		 << "\t\t\tinstead of checking every candidate on the file system\n"
+		 << "\t\t\tThis assumes a case-sensitive file system\n"
+		 << "      --group NAME\tWith --unity, put the inputs which follow in a unity translation unit\n"
+		 << "\t\t\tof their own, e.g. to isolate files whose static symbols conflict\n"
+		 << "\t\t\tThe groups are written after the other units, in the order they are given\n"
 		 << "  -h, --help\t\tPrint this help message and exit\n"
+		 << "      --hoist\t\tMove the angle includes which are not found, and not in a conditional,\n"
+		 << "\t\t\tto the beginning of the output, each once, in the order they are found\n"
 		 << "  -I, --include PATH\tAdd PATH to include paths\n"
+		 << "  -j, --jobs N\t\tGenerate up to N outputs at the same time, 0 means one per CPU\n"
+		 << "\t\t\tThe outputs are the same as with -j 1, which is the default\n"
+		 << "      --keep-comment TEXT\n"
+		 << "\t\t\tWith --strip-comments, keep the comments containing TEXT, such as a license\n"
+		 << "\t\t\tMay be given several times\n"
+		 << "      --no-hoist HEADER\n"
+		 << "\t\t\tWith --hoist, leave #include <HEADER> where it is, e.g. if it depends\n"
+		 << "\t\t\ton macros defined before it. May be given several times\n"
 		 << "  -o, --out FILE\tSet the output file name to FILE\n"
 		 << "\t\t\tBy default, the output will print to the console\n"
+		 << "\t\t\tWith several input files, the n-th -o is the output of the n-th FILE\n"
+		 << "\t\t\tThey are processed together, sharing what has been read and resolved\n"
+		 << "      --prefetch N\tRead included files ahead on N background threads\n"
+		 << "\t\t\tThis hides I/O latency on cold caches or network file systems\n"
+		 << "      --server SOCKET\tAnswer the clients connecting to the Unix-domain socket SOCKET, one at a time,\n"
+		 << "\t\t\tkeeping what has been read, scanned and resolved in memory between them\n"
+		 << "\t\t\tFiles and directories which have changed since are read again\n"
+		 << "      --shards N\tSplit each output into N files, OUT.1.EXT to OUT.N.EXT, of about the same size\n"
+		 << "\t\t\tto be compiled in parallel. They are cut between the files the input\n"
+		 << "\t\t\tincludes outside of conditionals, and each one expands all it needs\n"
+		 << "\t\t\ton its own. What comes before the first and after the last of those\n"
+		 << "\t\t\tincludes is common to every shard\n"
+		 << "      --stats[=json]\tPrint statistics to stderr: time spent in each phase, I/O and caches\n"
+		 << "\t\t\tWith --stats=json, print them as a JSON object\n"
+		 << "      --stream\t\tWrite the output while it is generated, through a fixed-size buffer\n"
+		 << "\t\t\tMemory use then does not grow with the output. An output file is only\n"
+		 << "\t\t\treplaced once complete, but an error may leave stdout truncated\n"
+		 << "      --strip-comments\tRemove the comments of the files expanded and collapse runs of blank lines\n"
+		 << "\t\t\tThe comments added around expanded files are left out as well\n"
+		 << "      --trace FILE\tWrite a timeline of the run to FILE as trace-event JSON,\n"
+		 << "\t\t\tto be opened with Perfetto or chrome://tracing\n"
 		 << "  -t, --tree\t\tPrint dependent tree\n"
+		 << "  -U, --undefine NAME\tTake NAME as undefined, the same way as -D\n"
+		 << "      --unity N\tCombine the input files, such as .cpp files, into N unity translation\n"
+		 << "\t\t\tunits of about the same size, written to OUT.1.EXT to OUT.N.EXT\n"
+		 << "\t\t\t(OUT itself if there is one). Each file included by several inputs\n"
+		 << "\t\t\tof a unit is expanded once in it, as if they were a single input\n"
 		 << "  -v, --verbose\t\tPrint more information to stderr (implicitly include --tree)\n"
+		 << "      --write-if-changed\n"
+		 << "\t\t\tLeave an output file untouched if its content is the same,\n"
+		 << "\t\t\totherwise replace it at once, so it is never seen half written\n"
 		 << endl;
 }
 
-error_state parse_option(list<string>& args, state_t& state, option_t op, const string& extra = "") {
+// Parse the non-negative number given to option
+error_state parse_count(list<string>& args, const string& extra, const string& option, size_t& count) {
+	string arg;
+	if(extra.empty()) {
+		if(args.empty()) {
+			return { E_BAD_ARGUMENT, option };
+		}
+		arg = args.front();
+		args.pop_front();
+	} else {
+		arg = extra;
+	}
+	if(arg.empty() || arg.find_first_not_of("0123456789") != string::npos || arg.size() > 6) {
+		return { E_BAD_ARGUMENT, arg };
+	}
+	count = stoul(arg);
+	return E_NO_ERROR;
+}
+
+error_state parse_option(list<string>& args, amalgamator_t& state, option_t op, const string& extra = "") {
 	switch(op) {
 	case O_INCLUDE_ALL: {
-		include_all = true;
+		state.options.include_all = true;
+		break;
+	}
+	case O_CACHE_DIR: {
+		fs::path arg;
+		if(!extra.empty()) {
+			arg = extra;
+		} else if(!args.empty()) {
+			arg = args.front();
+			args.pop_front();
+		} else {
+			return { E_BAD_ARGUMENT, "--cache-dir" };
+		}
+		error_code ec;
+		fs::create_directories(arg, ec);
+		if(!fs::is_directory(arg)) {
+			return { E_DIR_NOT_EXIST, arg.string() };
+		}
+		state.cacheDir		 = fs::canonical(arg);
+		state.resolver.track = true;
+		break;
+	}
+	case O_DEFINE:
+	case O_UNDEFINE: {
+		string arg = extra;
+		if(arg.empty() && !args.empty()) {
+			arg = args.front();
+			args.pop_front();
+		}
+		if(arg.empty() || arg[0] == '=') {
+			return { E_BAD_ARGUMENT, op == O_DEFINE ? "-D" : "-U" };
+		}
+		if(op == O_DEFINE) {
+			state.macros.define(arg);
+		} else {
+			state.macros.undefine(arg);
+		}
+		break;
+	}
+	case O_DEPFILE: { // -MF FILE or --depfile FILE
+		if(!extra.empty()) {
+			cli.depFile = extra;
+		} else if(!args.empty()) {
+			cli.depFile = args.front();
+			args.pop_front();
+		} else {
+			return { E_BAD_ARGUMENT, "--depfile" };
+		}
+		break;
+	}
+	case O_DIR_INDEX: {
+		state.resolver.use_index = true;
 		break;
 	}
 	case O_DRY: {
-		dry_run = true;
+		state.options.dry_run = true;
 		break;
 	}
 	case O_HELP: {
 		print_help();
 		return E_FINISH;
 	}
+	case O_HOIST: {
+		state.options.hoist = true;
+		break;
+	}
 	case O_INCLUDE_PATH: {
 		fs::path arg;
 		if(extra.empty()) {
@@ -213,6 +310,58 @@ error_state parse_option(list<string>& args, state_t& state, option_t op, const
 		state.includePaths.push_back(fs::canonical(arg));
 		break;
 	}
+	case O_JOBS: {
+		if(auto error = parse_count(args, extra, "-j", state.options.jobs); error != E_NO_ERROR) {
+			return error;
+		}
+		if(state.options.jobs == 0) {
+			state.options.jobs = max(thread::hardware_concurrency(), 1u);
+		}
+		break;
+	}
+	case O_KEEP_COMMENT: {
+		if(!extra.empty()) {
+			state.keepComments.push_back(extra);
+		} else if(!args.empty() && !args.front().empty()) {
+			state.keepComments.push_back(args.front());
+			args.pop_front();
+		} else {
+			return { E_BAD_ARGUMENT, "--keep-comment" };
+		}
+		break;
+	}
+	case O_MAKE_DEPS: { // -MD or -MF
+		if(extra == "D") {
+			cli.depPerOutput = true;
+		} else if(!extra.empty() && extra[0] == 'F') {
+			return parse_option(args, state, O_DEPFILE, extra.substr(1));
+		} else {
+			return { E_UNKNOWN_OPTION, "-M" + extra };
+		}
+		break;
+	}
+	case O_GROUP: {
+		if(!extra.empty()) {
+			cli.group = extra;
+		} else if(!args.empty() && !args.front().empty()) {
+			cli.group = args.front();
+			args.pop_front();
+		} else {
+			return { E_BAD_ARGUMENT, "--group" };
+		}
+		break;
+	}
+	case O_NO_HOIST: {
+		if(!extra.empty()) {
+			state.noHoist.insert(extra);
+		} else if(!args.empty() && !args.front().empty()) {
+			state.noHoist.insert(args.front());
+			args.pop_front();
+		} else {
+			return { E_BAD_ARGUMENT, "--no-hoist" };
+		}
+		break;
+	}
 	case O_OUT: {
 		fs::path arg;
 		if(extra.empty()) {
@@ -221,7 +370,62 @@ error_state parse_option(list<string>& args, state_t& state, option_t op, const
 		} else {
 			arg = extra;
 		}
-		state.outfilename = arg;
+		cli.outfilenames.push_back(arg);
+		break;
+	}
+	case O_PREFETCH: {
+		size_t threads;
+		if(auto error = parse_count(args, extra, "--prefetch", threads); error != E_NO_ERROR) {
+			return error;
+		}
+		state.prefetcher.stop(); // Given twice, the last one wins
+		state.prefetcher.start(threads);
+		break;
+	}
+	case O_SHARDS: {
+		if(auto error = parse_count(args, extra, "--shards", state.options.shards); error != E_NO_ERROR) {
+			return error;
+		}
+		if(state.options.shards == 0) {
+			return { E_BAD_ARGUMENT, "--shards 0" };
+		}
+		break;
+	}
+	case O_UNITY: {
+		if(auto error = parse_count(args, extra, "--unity", state.options.unity); error != E_NO_ERROR) {
+			return error;
+		}
+		if(state.options.unity == 0) {
+			return { E_BAD_ARGUMENT, "--unity 0" };
+		}
+		break;
+	}
+	case O_STATS: {
+		if(extra == "json") {
+			stats_json = true;
+		} else if(!extra.empty()) {
+			return { E_BAD_ARGUMENT, "--stats=" + extra };
+		}
+		state.stats.enabled = true;
+		break;
+	}
+	case O_STREAM: {
+		state.options.streaming = true;
+		break;
+	}
+	case O_STRIP_COMMENTS: {
+		state.options.strip_comments = true;
+		break;
+	}
+	case O_TRACE: {
+		if(!extra.empty()) {
+			state.tracer.open(extra);
+		} else if(!args.empty()) {
+			state.tracer.open(args.front());
+			args.pop_front();
+		} else {
+			return { E_BAD_ARGUMENT, "--trace" };
+		}
 		break;
 	}
 	case O_TREE: {
@@ -229,7 +433,11 @@ error_state parse_option(list<string>& args, state_t& state, option_t op, const
 		break;
 	}
 	case O_VERBOSE: {
-		verbose = true;
+		state.options.verbose = true;
+		break;
+	}
+	case O_WRITE_IF_CHANGED: {
+		state.options.if_changed = true;
 		break;
 	}
 	case OPTION_COUNT: { // Avoid warning, this should never be reached
@@ -239,8 +447,7 @@ error_state parse_option(list<string>& args, state_t& state, option_t op, const
 	return E_NO_ERROR;
 }
 
-state_t parse_config(int argc, char* argv[]) {
-	state_t state;
+error_state parse_config(int argc, char* argv[], amalgamator_t& state) {
 	if(argc == 0) {
 		print_help();
 		return { E_TOO_LESS_ARGUMENTS };
@@ -255,13 +462,18 @@ state_t parse_config(int argc, char* argv[]) {
 		arg = args.front();
 		args.pop_front();
 		if(arg[0] == '-') { // options
-			if(arg[1] == '-') { // long options
-				if(auto it = long_options.find(arg.substr(2)); it != long_options.end()) {
-					if(auto error = parse_option(args, state, it->second); error != E_NO_ERROR) {
+			if(arg[1] == '-') { // long options, the value may follow a '='
+				size_t eq = arg.find('=');
+				if(auto it = long_options.find(arg.substr(2, eq - 2)); it != long_options.end()) {
+					if(eq != string::npos && flag_options.count(it->second)) {
+						return { E_BAD_ARGUMENT, arg };
+					}
+					string value = eq == string::npos ? "" : arg.substr(eq + 1);
+					if(auto error = parse_option(args, state, it->second, value); error != E_NO_ERROR) {
 						return error;
 					}
 				} else {
-					return { { E_UNKNOWN_OPTION, arg } };
+					return { E_UNKNOWN_OPTION, arg };
 				}
 			} else { // short options
 				if(auto it = short_options.find(arg[1]); it != short_options.end()) {
@@ -269,163 +481,279 @@ state_t parse_config(int argc, char* argv[]) {
 						return error;
 					}
 				} else {
-					return { { E_UNKNOWN_OPTION, arg } };
+					return { E_UNKNOWN_OPTION, arg };
 				}
 			}
 		} else {
-			if(!state.file.name.empty()) {
-				return { E_TOO_MANY_INPUT };
-			}
-			state.file.name = arg;
-			if(!fs::is_regular_file(state.file.name)) {
-				return { { E_FILE_NOT_EXIST, state.file.name.string() } };
+			if(!fs::is_regular_file(arg)) {
+				return { E_FILE_NOT_EXIST, arg };
 			}
-			state.file.name = fs::canonical(state.file.name);
+			state.targets.emplace_back(state.paths.intern(fs::canonical(arg).string()));
+			cli.groups.push_back(cli.group);
 		}
 	}
-	return state;
-}
-
-error_state parse_include(state_t& config, file_t& file, string& out) {
-	ifstream fin;
-	fin.open(file.name);
-	if(!fin.is_open()) {
-		return { E_FILE_ERROR, "Cannot open file " + config.file.name.string() };
-	}
-	config.includedFiles.insert(file);
-	string line;
-	string includeFile;
-	auto   search_paths = config.includePaths;
-	if(!file.is_angle) {
-		log("Add current path to search: " + file.name.parent_path().string());
-		search_paths.push_front(file.name.parent_path());
-	}
-	while(!fin.eof()) {
-		getline(fin, line);
-		if(!regex_match(line, regex_include)) {
-			out += line + '\n';
-		} else {
-			file_t temp;
-			if(regex_match(line, regex_system_include)) {
-				temp.is_angle = true;
-			}
-			auto it1 = line.begin();
-			while(*it1 != '<' && *it1 != '"') { // Since line match the regex, skip to it directly
-				++it1;
-			}
-			++it1;
-			while(isspace(*it1)) {
-				++it1;
-			}
-			auto it2 = it1;
-			while(*it2 != '>' && *it2 != '"' && !isspace(*it2)) {
-				++it2;
-			}
-			includeFile.assign(it1, it2);
-			log("Found include file " + add_quote(includeFile, temp.is_angle));
-			bool	 found = false;
-			fs::path canonicalFile;
-			string	 content;
-			for(auto& p : search_paths) {
-				canonicalFile = p / includeFile;
-				if(fs::is_regular_file(canonicalFile)) {
-					canonicalFile = fs::canonical(canonicalFile);
-					found		  = true;
-					temp.name	  = canonicalFile;
-					log("Include file expends to " + canonicalFile.string());
-					if(!include_all && config.includedFiles.find(canonicalFile) != config.includedFiles.end()) {
-						log("Include file already exists, ignore");
-						temp.state = I_ALREADY_INCLUDED;
-					} else {
-						temp.state = I_EXPENDED;
-						if(auto err = parse_include(config, temp, content); err != E_NO_ERROR) {
-							return err;
-						}
-					}
-					file.includeFiles.push_back(temp);
-				}
-			}
-			if(!found) {
-				log("Ignore include file " + add_quote(includeFile, temp.is_angle) + " because of not found (may be system header)");
-				temp.name  = includeFile;
-				temp.state = I_NOT_FOUND;
-				file.includeFiles.push_back(temp);
-				out += line + '\n';
-			} else {
-				if(temp.state == I_EXPENDED) {
-					out += "// " + line + '\n';
-					out += content;
-					out += "// End " + line + '\n';
-				} else {
-					out += "// " + line + " (omitted because it has been expended)\n";
-				}
-			}
+	if(state.targets.empty()) {
+		return { E_TOO_LESS_ARGUMENTS };
+	}
+	if(state.options.unity) {
+		if(state.options.shards > 1) {
+			return { E_BAD_ARGUMENT, "--shards with --unity" };
+		}
+		if(cli.outfilenames.size() > 1) {
+			return { E_TOO_MANY_OUTPUT };
+		}
+		if(cli.outfilenames.empty() && (!state.options.dry_run || cli.depPerOutput || !cli.depFile.empty())) {
+			return { E_NO_OUTPUT, string(state.paths.str(state.targets.front().name)) };
+		}
+		state.plan_unity(cli.groups, cli.outfilenames.empty() ? fs::path() : cli.outfilenames.front());
+		return E_NO_ERROR;
+	}
+	if(cli.outfilenames.size() > state.targets.size()) {
+		return { E_TOO_MANY_OUTPUT };
+	}
+	auto out = cli.outfilenames.begin();
+	for(auto& t : state.targets) {
+		if(out != cli.outfilenames.end()) {
+			t.outfilename = *out++;
+		} else if(((state.targets.size() > 1 || state.options.shards > 1) && !state.options.dry_run) || cli.depPerOutput || !cli.depFile.empty()) {
+			return { E_NO_OUTPUT, string(state.paths.str(t.name)) }; // Dependency files need a name for the rule
 		}
 	}
-	fin.close();
 	return E_NO_ERROR;
 }
 
-void dump_tree(const file_t& f, int depth) {
+// shard is the label of the files of a unit of the root, with --shards
+void dump_tree(const amalgamator_t& config, const include_graph_t& graph, const edge_t& e, int depth, const string& label = "") {
 	string prefix(2 * depth, ' ');
 	cout << prefix
-		 << add_quote(f.name.string(), f.is_angle)
-		 << " (" << include_msg[f.state] << ")\n";
-	for(auto& i : f.includeFiles) {
-		dump_tree(i, depth + 1);
+		 << quoted_t { config.paths.str(graph.node(e.node).name), e.is_angle }
+		 << " (" << include_msg[e.state] << ")" << label << "\n";
+	if(e.state == I_EXPENDED) { // Only the edge expanding a file shows its children
+		for(auto& i : graph.children(e)) {
+			dump_tree(config, graph, i, depth + 1);
+		}
 	}
 }
 
-void dump(const state_t& config) {
-	cout << "Target name: " << config.file.name.string() << endl;
+// Tree of the root of target, of each of its inputs for a unity translation unit, or of each shard
+void dump_trees(const amalgamator_t& config, const target_t& target) {
+	for(size_t k = 0; k < target.shardGraphs.size(); ++k) { // Each shard expands its own files
+		dump_tree(config, target.shardGraphs[k], { 0, I_EXPENDED, false }, 0, " [shard " + to_string(k + 1) + "]");
+	}
+	if(!target.shardGraphs.empty()) {
+		return;
+	}
+	if(target.sources.empty()) {
+		dump_tree(config, target.graph, { 0, I_EXPENDED, false }, 0);
+	}
+	for(auto id : target.sources) {
+		dump_tree(config, target.graph, { id, I_EXPENDED, false }, 0);
+	}
+}
+
+void print_stats(const amalgamator_t& config) {
+	auto& r = config.resolver;
+	if(stats_json) {
+		cerr << "{\n  \"phases\": {";
+		for(int p = 0; p < PHASE_COUNT; ++p) {
+			cerr << (p ? "," : "") << "\n    \"" << phase_names[p] << "\": { \"wall_ns\": " << config.stats.wall[p] << ", \"cpu_ns\": " << config.stats.cpu[p] << " }";
+		}
+		cerr << "\n  },\n"
+			 << "  \"files_opened\": " << config.stats.files_opened << ",\n"
+			 << "  \"bytes_read\": " << config.stats.bytes_read << ",\n"
+			 << "  \"bytes_written\": " << config.stats.bytes_written << ",\n"
+			 << "  \"bytes_stripped\": " << config.stats.bytes_stripped << ",\n"
+			 << "  \"max_depth\": " << config.stats.max_depth << ",\n"
+			 << "  \"resolution\": { \"hits\": " << r.hits << ", \"misses\": " << r.misses << ", \"not_found\": " << r.negative
+			 << ", \"stat_calls\": " << r.probes << ", \"canonical_calls\": " << r.canonical << " },\n"
+			 << "  \"dir_index\": { \"listed\": " << r.index.listed << ", \"entries\": " << r.index.entries << " },\n"
+			 << "  \"scan_cache\": { \"hits\": " << config.cache.hits << ", \"misses\": " << config.cache.misses << " }\n"
+			 << "}" << endl;
+		return;
+	}
+	for(int p = 0; p < PHASE_COUNT; ++p) {
+		cerr << "Phase " << phase_names[p] << ": " << config.stats.wall[p] / 1e6 << " ms wall, " << config.stats.cpu[p] / 1e6 << " ms CPU" << endl;
+	}
+	cerr << "Files: " << config.stats.files_opened << " opened, " << config.stats.bytes_read << " bytes read, "
+		 << config.stats.bytes_written << " bytes written, include depth up to " << config.stats.max_depth << endl;
+	if(config.options.strip_comments) {
+		cerr << "Comments and blank lines: " << config.stats.bytes_stripped << " bytes removed" << endl;
+	}
+	if(!config.cacheDir.empty()) {
+		cerr << "Scan cache: " << config.cache.hits << " hits, " << config.cache.misses << " misses" << endl;
+	}
+	cerr << "Resolution cache: " << r.hits << " hits, " << r.misses << " misses ("
+		 << r.negative << " not found), " << r.probes << " files probed, " << r.canonical << " canonical paths" << endl;
+	if(r.use_index) {
+		cerr << "Directory index: " << r.index.listed << " directories listed, " << r.index.entries << " entries" << endl;
+	}
+}
+
+void dump(const amalgamator_t& config, const target_t& target) {
+	cout << "Target name: " << config.paths.str(target.name) << endl;
 	cout << "Include paths:\n";
 	for(auto& f : config.includePaths) {
 		cout << '\t' << f.string() << endl;
 	}
 	cout << "All included files:\n";
-	for(auto& f : config.includedFiles) {
-		cout << '\t' << f.string() << endl;
+	for(auto f : config.sorted_files(target)) {
+		cout << '\t' << config.paths.str(f) << endl;
 	}
 	cout << "Tree view:\n";
-	dump_tree(config.file, 0);
+	dump_trees(config, target);
 }
 
-int main(int argc, char* argv[]) {
-	progname	   = argv[0];
-	state_t config = parse_config(argc - 1, argv + 1);
-	if(config.error == E_FINISH) {
+// Everything the command line asks for, argv[0] being the program name
+int run(int argc, char* argv[], amalgamator_t& config) {
+	int64_t		start_wall = wall_ns(), start_cpu = thread_cpu_ns();
+	error_state status	   = parse_config(argc - 1, argv + 1, config);
+	config.stats.wall[P_OPTIONS] += wall_ns() - start_wall; // Not known to be needed before
+	config.stats.cpu[P_OPTIONS] += thread_cpu_ns() - start_cpu;
+	if(status == E_FINISH) {
 		return E_NO_ERROR;
-	} else if(config.error != E_NO_ERROR) {
-		cerr << config.error.what() << endl;
-		return config.error;
+	} else if(status != E_NO_ERROR) {
+		cerr << status.what() << endl;
+		return status;
 	}
-	string		content = header;
-	error_state error	= parse_include(config, config.file, content);
-	if(error == E_FINISH) {
-		return E_NO_ERROR;
-	} else if(error != E_NO_ERROR) {
+	if(!config.cacheDir.empty()) {
+		config.load_cache();
+	}
+	auto errors = config.generate_all();
+	if(config.tracer.enabled() && !config.tracer.write()) {
+		error_state error { E_FILE_ERROR, "Cannot write trace file" };
 		cerr << error.what() << endl;
 		return error;
 	}
-	if(!dry_run) {
-		if(!config.outfilename.empty()) {
-			ofstream fout;
-			fout.open(config.outfilename);
-			if(!fout.is_open()) {
-				error_state error { E_FILE_ERROR, "Cannot open output file: " + config.outfilename.string() };
-				cerr << error.what() << endl;
-				return error;
-			}
-			fout << content;
-			fout.close();
-		} else {
-			cout << content;
+	auto error	= errors.begin();
+	for(auto& target : config.targets) {
+		if(*error != E_NO_ERROR) { // Targets are started in order, so this is the first failure
+			cerr << error->what() << endl;
+			return *error;
 		}
+		++error;
+		if(config.options.verbose) {
+			dump(config, target);
+		} else if(tree) {
+			dump_trees(config, target);
+		}
+	}
+	if(auto error = config.write_depfiles(cli.depPerOutput, cli.depFile); error != E_NO_ERROR) {
+		cerr << error.what() << endl;
+		return error;
+	}
+	if(!config.cacheDir.empty()) {
+		config.save_cache();
 	}
-	if(verbose) {
-		dump(config);
-	} else if(tree) {
-		dump_tree(config.file, 0);
+	if(config.stats.enabled) {
+		print_stats(config);
 	}
 	return E_NO_ERROR;
 }
+
+#ifndef _WIN32
+// Run the command lines of the clients one after the other, keeping config and its caches between them
+int serve(const string& socket, amalgamator_t& config) {
+	local_listener_t listener(socket);
+	string			 error;
+	if(!listener.listen(error)) {
+		error_state state { E_FILE_ERROR, socket + ": " + error };
+		cerr << state.what() << endl;
+		return state;
+	}
+	fs::path home = fs::current_path();
+	while(true) {
+		int		  client = listener.accept();
+		request_t request;
+		if(client < 0) {
+			error_state state { E_FILE_ERROR, socket + ": " + strerror(errno) };
+			cerr << state.what() << endl;
+			return state;
+		}
+		if(receive_request(client, request)) {
+			vector<char*> argv;
+			for(auto& a : request.args) {
+				argv.push_back(a.data());
+			}
+			int status;
+			cout.flush();
+			cerr.flush();
+			{
+				redirect_t redirect(request.out, request.err);
+				config.reset();
+				tree	   = false;
+				stats_json = false;
+				cli		   = command_line_t();
+				error_code ec;
+				if(fs::current_path(request.cwd, ec); ec) {
+					error_state state { E_DIR_NOT_EXIST, request.cwd };
+					cerr << state.what() << endl;
+					status = state;
+				} else {
+					status = run(int(argv.size()), argv.data(), config);
+				}
+				cout.flush();
+				cerr.flush();
+			}
+			cout.clear(); // A client gone leaves them failed
+			cerr.clear();
+			fs::current_path(home);
+			send_status(client, status);
+		}
+		close_fd(request.out);
+		close_fd(request.err);
+		close_fd(client);
+	}
+}
+
+// Have the server run the command line, or run it here if there is none
+int connect(const string& socket, int argc, char* argv[], amalgamator_t& config) {
+	int client = connect_local(socket);
+	if(client < 0) {
+		return run(argc, argv, config);
+	}
+	request_t request { fs::current_path().string(), { argv, argv + argc } };
+	int		  status = E_NO_ERROR;
+	if(!send_request(client, request) || !receive_status(client, status)) {
+		close_fd(client);
+		error_state state { E_FILE_ERROR, socket + ": The server has not answered" };
+		cerr << state.what() << endl;
+		return state;
+	}
+	close_fd(client);
+	return status;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+	progname = argv[0];
+	amalgamator_t config; // Not movable, as it is shared by the workers
+	string		  mode = argc > 1 ? argv[1] : "";
+	if(mode != "--server" && mode != "--connect") {
+		return run(argc, argv, config);
+	} else if(argc < 3) {
+		error_state state { E_TOO_LESS_ARGUMENTS };
+		cerr << state.what() << endl;
+		return state;
+	}
+#ifdef _WIN32
+	if(mode == "--server") {
+		error_state state { E_BAD_ARGUMENT, "--server, no Unix-domain socket on Windows" };
+		cerr << state.what() << endl;
+		return state;
+	}
+	argv[2] = argv[0]; // No server, run the rest here
+	return run(argc - 2, argv + 2, config);
+#else
+	if(mode == "--server") {
+		if(argc > 3) {
+			error_state state { E_BAD_ARGUMENT, argv[3] };
+			cerr << state.what() << endl;
+			return state;
+		}
+		return serve(argv[2], config);
+	}
+	string socket = argv[2];
+	argv[2]		  = argv[0]; // The command line given to the server
+	return connect(socket, argc - 2, argv + 2, config);
+#endif
+}
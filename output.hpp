@@ -0,0 +1,234 @@
+/**
+ * @file      output.hpp
+ * @brief     Segment list used to build the output of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_OUTPUT_HPP
+#define SINGLEINCLUDE_OUTPUT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Output built from segments instead of one growing string
+ * @note  Segments only reference their bytes: the input buffers and string
+ *        literals must outlive the output. Pieces built at runtime are kept
+ *        by append_copy(). The bytes are copied exactly once, by write().
+ *        Once stream_to() is called, nothing is kept any more: the bytes go
+ *        through a fixed-size buffer straight to the sink.
+ */
+class output_t {
+public:
+	static constexpr size_t default_buffer = 256 * 1024;
+
+	void append(std::string_view s) {
+		if(s.empty()) {
+			return;
+		}
+		total += s.size();
+		if(streaming) {
+			if(buffer.size() + s.size() > buffer.capacity()) {
+				flush();
+			}
+			if(s.size() >= buffer.capacity()) { // Too large to be worth a copy
+				sink(s);
+			} else {
+				buffer.append(s);
+			}
+			return;
+		}
+		if(segments.size() > sealed) { // Merge with the previous segment if they are adjacent in memory
+			auto& last = segments.back();
+			if(last.data() + last.size() == s.data()) {
+				last = { last.data(), last.size() + s.size() };
+				return;
+			}
+		}
+		segments.push_back(s);
+	}
+
+	void append_copy(std::string s) {
+		if(streaming) {
+			append(s);
+			return;
+		}
+		literals.push_back(std::move(s));
+		append(literals.back());
+	}
+
+	size_t size() const {
+		return total;
+	}
+
+	// Get the current end, where insert() may add bytes later. Not possible once streaming
+	size_t mark() {
+		sealed = segments.size();
+		return sealed;
+	}
+
+	// Add pieces at a position given by mark(), before what has been appended since
+	void insert(size_t at, const std::vector<std::string_view>& pieces) {
+		segments.insert(segments.begin() + static_cast<std::ptrdiff_t>(at), pieces.begin(), pieces.end());
+		for(auto& s : pieces) {
+			total += s.size();
+		}
+	}
+
+#ifdef _WIN32
+	void stream_to(std::ostream* os, size_t buffer_size = default_buffer) {
+		stream = os;
+		start_streaming(buffer_size);
+	}
+#else
+	// Write what is appended from now on to fd, or drop it if fd is -1
+	void stream_to(int fd, size_t buffer_size = default_buffer) {
+		stream = fd;
+		start_streaming(buffer_size);
+	}
+#endif
+
+	// Drop what is appended from now on, so only its size is known
+	void discard() {
+#ifdef _WIN32
+		stream_to(nullptr);
+#else
+		stream_to(-1);
+#endif
+	}
+
+	// Write the buffered bytes, return false if any write to the sink failed
+	bool flush() {
+		if(!buffer.empty()) {
+			sink(buffer);
+			buffer.clear();
+		}
+		return ok;
+	}
+
+	void write(std::ostream& os) const {
+		for(auto& s : segments) {
+			os.write(s.data(), static_cast<std::streamsize>(s.size()));
+		}
+	}
+
+#ifndef _WIN32
+	bool write(int fd) const {
+#ifdef IOV_MAX
+		constexpr size_t max_iov = IOV_MAX;
+#else
+		constexpr size_t max_iov = 1024;
+#endif
+		std::vector<iovec> iov;
+		iov.reserve(std::min(segments.size(), max_iov));
+		size_t i = 0;
+		while(i < segments.size()) {
+			iov.clear();
+			for(; i < segments.size() && iov.size() < max_iov; ++i) {
+				iov.push_back({ const_cast<char*>(segments[i].data()), segments[i].size() });
+			}
+			size_t first = 0;
+			while(first < iov.size()) {
+				ssize_t n = writev(fd, iov.data() + first, static_cast<int>(iov.size() - first));
+				if(n < 0) {
+					if(errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				// Skip what has been written, which may end in the middle of a segment
+				size_t done = static_cast<size_t>(n);
+				while(first < iov.size() && done >= iov[first].iov_len) {
+					done -= iov[first++].iov_len;
+				}
+				if(done) {
+					iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + done;
+					iov[first].iov_len -= done;
+				}
+			}
+		}
+		return true;
+	}
+#endif
+
+	// Check whether the output is exactly s, without building it
+	bool equals(std::string_view s) const {
+		if(s.size() != total) {
+			return false;
+		}
+		size_t pos = 0;
+		for(auto& seg : segments) {
+			if(s.compare(pos, seg.size(), seg) != 0) {
+				return false;
+			}
+			pos += seg.size();
+		}
+		return true;
+	}
+
+	std::string str() const {
+		std::string s;
+		s.reserve(total);
+		for(auto& seg : segments) {
+			s += seg;
+		}
+		return s;
+	}
+
+private:
+	std::vector<std::string_view> segments;
+	std::deque<std::string>		  literals; // deque never moves its elements
+	size_t						  total		= 0;
+	size_t						  sealed	= 0; // Segments before it are not merged with anything
+	bool						  streaming = false;
+	bool						  ok		= true;
+	std::string					  buffer; // Its capacity is the size of the buffer
+#ifdef _WIN32
+	std::ostream* stream = nullptr;
+#else
+	int stream = -1;
+#endif
+
+	// Write what has been kept so far, then keep nothing
+	void start_streaming(size_t buffer_size) {
+		streaming = true;
+		buffer.reserve(buffer_size);
+		for(auto& seg : segments) {
+			sink(seg);
+		}
+		segments.clear();
+		literals.clear();
+	}
+
+	void sink(std::string_view s) {
+#ifdef _WIN32
+		if(stream && ok) {
+			ok = static_cast<bool>(stream->write(s.data(), static_cast<std::streamsize>(s.size())));
+		}
+#else
+		while(stream >= 0 && ok && !s.empty()) {
+			ssize_t n = ::write(stream, s.data(), s.size());
+			if(n < 0) {
+				ok = errno == EINTR;
+				continue;
+			}
+			s.remove_prefix(static_cast<size_t>(n));
+		}
+#endif
+	}
+};
+
+#endif // SINGLEINCLUDE_OUTPUT_HPP
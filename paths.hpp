@@ -0,0 +1,154 @@
+/**
+ * @file      paths.hpp
+ * @brief     Interned paths of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_PATHS_HPP
+#define SINGLEINCLUDE_PATHS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using path_id_t = uint32_t;
+
+constexpr path_id_t no_path = UINT32_MAX;
+
+/**
+ * @brief Every path seen, each stored once and named by a 32-bit id
+ * @note  The strings live in an arena which is never freed nor moved, so
+ *        str() stays valid as long as the table. Names of headers which are
+ *        not found are interned as well. It may be shared by several threads.
+ */
+class path_table_t {
+public:
+	path_table_t() = default;
+	path_table_t(const path_table_t&) = delete;
+	path_table_t& operator=(const path_table_t&) = delete;
+
+	path_id_t intern(std::string_view s) {
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			if(auto it = ids.find(s); it != ids.end()) {
+				return it->second;
+			}
+		}
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		if(auto it = ids.find(s); it != ids.end()) { // Added meanwhile
+			return it->second;
+		}
+		std::string_view stored = store(s);
+		path_id_t		 id		= static_cast<path_id_t>(strings.size());
+		strings.push_back(stored);
+		parents.push_back(no_path);
+		ids.emplace(stored, id);
+		return id;
+	}
+
+	std::string_view str(path_id_t id) const {
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return strings[id];
+	}
+
+	std::filesystem::path path(path_id_t id) const {
+		return std::filesystem::path(str(id));
+	}
+
+	// Id of the directory of a canonical path, computed once per path
+	path_id_t parent(path_id_t id) {
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			if(parents[id] != no_path) {
+				return parents[id];
+			}
+		}
+		path_id_t p = intern(path(id).parent_path().string());
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		parents[id] = p;
+		return p;
+	}
+
+	size_t size() const {
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return strings.size();
+	}
+
+private:
+	static constexpr size_t block_size = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>>			 blocks;
+	char*											 free_begin = nullptr;
+	size_t											 free_size	= 0;
+	std::vector<std::string_view>					 strings;
+	std::vector<path_id_t>							 parents;
+	std::unordered_map<std::string_view, path_id_t> ids;
+	mutable std::shared_mutex						 mutex;
+
+	std::string_view store(std::string_view s) {
+		if(s.size() > free_size) {
+			size_t size = std::max(block_size, s.size());
+			blocks.push_back(std::make_unique<char[]>(size));
+			free_begin = blocks.back().get();
+			free_size  = size;
+		}
+		if(!s.empty()) {
+			std::memcpy(free_begin, s.data(), s.size());
+		}
+		std::string_view stored(free_begin, s.size());
+		free_begin += s.size();
+		free_size -= s.size();
+		return stored;
+	}
+};
+
+// Set of path ids, one bit per id of the table
+class path_set_t {
+public:
+	// Return false if id was in the set already
+	bool insert(path_id_t id) {
+		if(id >= bits.size()) {
+			bits.resize(std::max<size_t>(id + 1, 2 * bits.size()));
+		}
+		if(bits[id]) {
+			return false;
+		}
+		bits[id] = true;
+		++count;
+		return true;
+	}
+
+	bool contains(path_id_t id) const {
+		return id < bits.size() && bits[id];
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	std::vector<path_id_t> ids() const {
+		std::vector<path_id_t> result;
+		result.reserve(count);
+		for(size_t i = 0; i < bits.size(); ++i) {
+			if(bits[i]) {
+				result.push_back(static_cast<path_id_t>(i));
+			}
+		}
+		return result;
+	}
+
+private:
+	std::vector<bool> bits;
+	size_t			  count = 0;
+};
+
+#endif // SINGLEINCLUDE_PATHS_HPP
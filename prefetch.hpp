@@ -0,0 +1,112 @@
+/**
+ * @file      prefetch.hpp
+ * @brief     Background reading of input files of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_PREFETCH_HPP
+#define SINGLEINCLUDE_PREFETCH_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Small pool of I/O threads running read-ahead jobs in FIFO order
+ * @note  Jobs only warm up shared state, nobody waits for a job itself.
+ *        Jobs still queued when the pool is destroyed are dropped.
+ */
+class prefetcher_t {
+public:
+	prefetcher_t() = default;
+	prefetcher_t(const prefetcher_t&) = delete;
+	prefetcher_t& operator=(const prefetcher_t&) = delete;
+	~prefetcher_t() {
+		stop();
+	}
+
+	void start(size_t threads) {
+		for(size_t i = 0; i < threads; ++i) {
+			workers.emplace_back([this] { run(); });
+		}
+	}
+
+	bool enabled() const {
+		return !workers.empty();
+	}
+
+	// Queue job, unless a drain() is waiting for the pool to be idle
+	void push(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(draining > 0) {
+				return;
+			}
+			jobs.push_back(std::move(job));
+		}
+		ready.notify_one();
+	}
+
+	/**
+	 * @brief Drop the queued jobs and wait for the running ones, the threads are kept
+	 * @note  Jobs pushed meanwhile, by the running ones in particular, are
+	 *        dropped too, so no job runs any more once it returns.
+	 */
+	void drain() {
+		std::unique_lock<std::mutex> lock(mutex);
+		++draining;
+		jobs.clear();
+		idle.wait(lock, [this] { return running == 0 && jobs.empty(); });
+		--draining;
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			jobs.clear();
+		}
+		ready.notify_all();
+		for(auto& t : workers) {
+			t.join();
+		}
+		workers.clear();
+		stopping = false; // So it can be started again
+	}
+
+private:
+	std::vector<std::thread>		  workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex						  mutex;
+	std::condition_variable			  ready;
+	std::condition_variable			  idle;
+	size_t							  running  = 0; // Jobs being run
+	size_t							  draining = 0; // Calls of drain() waiting
+	bool							  stopping = false;
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true) {
+			ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if(stopping) {
+				return;
+			}
+			auto job = std::move(jobs.front());
+			jobs.pop_front();
+			++running;
+			lock.unlock();
+			job();
+			lock.lock();
+			if(--running == 0) {
+				idle.notify_all();
+			}
+		}
+	}
+};
+
+#endif // SINGLEINCLUDE_PREFETCH_HPP
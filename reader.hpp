@@ -0,0 +1,178 @@
+/**
+ * @file      reader.hpp
+ * @brief     Read-only access to input files of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_READER_HPP
+#define SINGLEINCLUDE_READER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Identity of the content of a file, as far as the file system can tell
+struct file_id_t {
+	uint64_t dev	  = 0;
+	uint64_t ino	  = 0;
+	uint64_t size	  = 0;
+	int64_t	 mtime_ns = 0;
+
+	bool valid() const {
+		return dev != 0 || ino != 0;
+	}
+
+	bool operator==(const file_id_t& o) const {
+		return dev == o.dev && ino == o.ino && size == o.size && mtime_ns == o.mtime_ns;
+	}
+};
+
+#ifndef _WIN32
+inline int64_t mtime_ns_of(const struct stat& st) {
+#ifdef __APPLE__
+	return static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+#endif
+
+// Identity of the file name as it is now, invalid if it is not a regular file or on Windows
+inline file_id_t file_id_of(const std::filesystem::path& name) {
+#ifdef _WIN32
+	return {};
+#else
+	struct stat st;
+	if(::stat(name.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+		return {};
+	}
+	return { static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_size), mtime_ns_of(st) };
+#endif
+}
+
+/**
+ * @brief Content of one input file
+ * @note  Large files are mapped read-only, small ones are read at once into
+ *        a buffer of the exact size. Either way text() stays valid as long
+ *        as the object lives.
+ */
+class source_file_t {
+public:
+	// Files smaller than this are read instead of mapped
+	static constexpr size_t map_threshold = 64 * 1024;
+
+	source_file_t() = default;
+	source_file_t(const source_file_t&) = delete;
+	source_file_t& operator=(const source_file_t&) = delete;
+	~source_file_t() {
+		close();
+	}
+
+	bool open(const std::filesystem::path& name) {
+		close();
+#ifdef _WIN32
+		// Keep the text mode translation of '\r\n' that ifstream always did
+		std::ifstream fin(name);
+		if(!fin.is_open()) {
+			return false;
+		}
+		buffer.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+		view = buffer;
+		return true;
+#else
+		int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd < 0) {
+			return false;
+		}
+		struct stat st;
+		bool		ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+		if(ok) {
+			size_t size = static_cast<size_t>(st.st_size);
+			file_id		= { static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), size, mtime_ns_of(st) };
+			if(size >= map_threshold) {
+				ok = map(fd, size);
+			} else {
+				ok = read_all(fd, size);
+			}
+		}
+		::close(fd);
+		return ok;
+#endif
+	}
+
+	void close() {
+#ifndef _WIN32
+		if(mapped) {
+			munmap(const_cast<char*>(view.data()), view.size());
+			mapped = false;
+		}
+#endif
+		buffer.clear();
+		view	= {};
+		file_id = {};
+	}
+
+	std::string_view text() const {
+		return view;
+	}
+
+	// Invalid on Windows, where nothing is cached
+	const file_id_t& id() const {
+		return file_id;
+	}
+
+private:
+	std::string		 buffer;
+	std::string_view view;
+	file_id_t		 file_id;
+	bool			 mapped = false;
+
+#ifndef _WIN32
+	bool map(int fd, size_t size) {
+		void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED) {
+			return read_all(fd, size);
+		}
+		madvise(p, size, MADV_SEQUENTIAL);
+		view   = { static_cast<const char*>(p), size };
+		mapped = true;
+		return true;
+	}
+
+	bool read_all(int fd, size_t size) {
+		buffer.resize(size);
+		size_t done = 0;
+		while(done < size) {
+			ssize_t n = ::read(fd, buffer.data() + done, size - done);
+			if(n < 0 && errno == EINTR) {
+				continue;
+			} else if(n < 0) {
+				return false;
+			}
+			if(n == 0) { // Truncated while reading
+				break;
+			}
+			done += static_cast<size_t>(n);
+		}
+		buffer.resize(done);
+		view = buffer;
+		return true;
+	}
+#endif
+};
+
+#endif // SINGLEINCLUDE_READER_HPP
@@ -0,0 +1,242 @@
+/**
+ * @file      resolver.hpp
+ * @brief     Include file resolution of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_RESOLVER_HPP
+#define SINGLEINCLUDE_RESOLVER_HPP
+
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include "paths.hpp"
+
+/**
+ * @brief In-memory listing of directories, filled lazily one level at a time
+ * @note  A directory is read once with a single listing instead of one stat
+ *        per candidate. Paths built from canonical directories and entries
+ *        which are not symlinks are canonical already, so no realpath is
+ *        needed either. Symlinks are left to the file system.
+ */
+class dir_index_t {
+public:
+	enum find_result_t {
+		F_FOUND,
+		F_NOT_FOUND,
+		F_UNKNOWN, // Cannot be answered by the index, ask the file system
+	};
+
+	size_t listed  = 0; // Number of directories listed
+	size_t entries = 0; // Number of entries read
+
+	/**
+	 * @brief Look up name relative to dir
+	 * @param dir    A canonical directory
+	 * @param result Set to the canonical path of the file if found
+	 */
+	find_result_t find(const std::filesystem::path& dir, std::string_view name, std::filesystem::path& result) {
+		std::filesystem::path rel(name);
+		if(rel.empty() || rel.has_root_path()) {
+			return F_UNKNOWN;
+		}
+		std::filesystem::path cur  = dir;
+		auto				  it   = rel.begin();
+		auto				  last = std::prev(rel.end());
+		std::string			  file = last->string();
+		if(file.empty() || file == "." || file == "..") {
+			return F_UNKNOWN;
+		}
+		for(; it != last; ++it) {
+			auto c = it->string();
+			if(c.empty() || c == ".") {
+				continue;
+			} else if(c == "..") { // cur never contains a symlink, so this is safe
+				cur = cur.parent_path();
+				continue;
+			}
+			switch(lookup(cur, c)) {
+			case E_DIR: cur /= c; break;
+			case E_SYMLINK: return F_UNKNOWN;
+			default: return F_NOT_FOUND;
+			}
+		}
+		switch(lookup(cur, file)) {
+		case E_FILE: result = cur / file; return F_FOUND;
+		case E_SYMLINK: return F_UNKNOWN;
+		default: return F_NOT_FOUND;
+		}
+	}
+
+private:
+	enum entry_type_t : unsigned char {
+		E_NONE,
+		E_FILE,
+		E_DIR,
+		E_SYMLINK,
+		E_OTHER,
+	};
+
+	std::unordered_map<std::string, std::unordered_map<std::string, entry_type_t>> dirs;
+
+	entry_type_t lookup(const std::filesystem::path& dir, const std::string& name) {
+		auto [it, inserted] = dirs.try_emplace(dir.string());
+		if(inserted) {
+			fill(dir, it->second);
+		}
+		auto entry = it->second.find(name);
+		return entry == it->second.end() ? E_NONE : entry->second;
+	}
+
+	void fill(const std::filesystem::path& dir, std::unordered_map<std::string, entry_type_t>& listing) {
+		namespace fs = std::filesystem;
+		std::error_code ec;
+		++listed;
+		for(fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			entry_type_t type;
+			switch(it->symlink_status(ec).type()) { // Usually known from the listing, without stat
+			case fs::file_type::regular: type = E_FILE; break;
+			case fs::file_type::directory: type = E_DIR; break;
+			case fs::file_type::symlink: type = E_SYMLINK; break;
+			default: type = E_OTHER; break;
+			}
+			listing.emplace(it->path().filename().string(), type);
+			++entries;
+		}
+	}
+};
+
+/**
+ * @brief Find include files in the search paths, remembering every answer
+ * @note  Headers which are not found are cached as well, so system headers
+ *        cost no syscall after the first lookup. Answers are ids of paths
+ *        interned in the table. It may be shared by several threads.
+ */
+class resolver_t {
+public:
+	size_t		hits	  = 0;
+	size_t		misses	  = 0;
+	size_t		probes	  = 0; // Number of candidates checked on the file system
+	size_t		negative  = 0; // Number of cached "not found"
+	size_t		canonical = 0; // Number of realpath calls
+	bool		use_index = false;
+	bool		track	  = false; // Fill watched
+	dir_index_t index;
+
+	// Directories whose content decided the answers, some may not exist
+	std::set<std::string> watched;
+
+	explicit resolver_t(path_table_t& table)
+		: paths(table) { }
+
+	/**
+	 * @brief  Search name in dir, then in include_paths
+	 * @param  dir Directory of the including file, no_path if it should not be searched
+	 * @return The canonical path of the file, or no_path if not found
+	 * @note   The directive form does not matter here: whether dir is searched
+	 *         is decided by how the including file itself was included
+	 */
+	path_id_t resolve(const std::list<std::filesystem::path>& include_paths, path_id_t dir, std::string_view name) {
+		std::string key = make_key(dir, name);
+		std::lock_guard<std::mutex> lock(mutex);
+		if(auto it = cache.find(key); it != cache.end()) {
+			++hits;
+			return it->second;
+		}
+		++misses;
+		auto& result = cache[std::move(key)];
+		if(dir != no_path && (result = probe(paths.path(dir), name)) != no_path) {
+			return result;
+		}
+		for(auto& p : include_paths) {
+			if((result = probe(p, name)) != no_path) {
+				return result;
+			}
+		}
+		++negative;
+		return no_path;
+	}
+
+	// Forget every answer, as the directories they depend on have changed
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		cache.clear();
+		index = dir_index_t();
+		watched.clear();
+		seen.clear();
+	}
+
+	// Add an answer found by an earlier run, dir is empty if it was not searched
+	void preload(std::string_view dir, std::string_view name, std::optional<std::string_view> result) {
+		std::string key = make_key(dir.empty() ? no_path : paths.intern(dir), name);
+		std::lock_guard<std::mutex> lock(mutex);
+		cache.try_emplace(std::move(key), result ? paths.intern(*result) : no_path);
+	}
+
+	// Call f(dir, name, result) for every answer, not to be used while resolving
+	template<typename F>
+	void for_each(F f) const {
+		for(auto& [key, result] : cache) {
+			path_id_t dir;
+			std::memcpy(&dir, key.data(), sizeof(dir));
+			f(dir, std::string_view(key).substr(sizeof(dir)), result);
+		}
+	}
+
+private:
+	path_table_t&							   paths;
+	std::unordered_map<std::string, path_id_t> cache; // The key is the id of dir then name
+	std::unordered_set<std::string>			   seen;  // Directory then directory part of name, for each one in watched
+	std::mutex								   mutex;
+
+	static std::string make_key(path_id_t dir, std::string_view name) {
+		std::string key(reinterpret_cast<const char*>(&dir), sizeof(dir));
+		key += name;
+		return key;
+	}
+
+	// Add the directory name is looked up in to watched, normalizing it only the first time
+	void watch(const std::filesystem::path& dir, std::string_view name) {
+		size_t		slash = name.find_last_of("/\\");
+		std::string key	  = dir.string();
+		key += '\0';
+		key += name.substr(0, slash == std::string_view::npos ? 0 : slash);
+		if(seen.insert(std::move(key)).second) {
+			watched.insert((dir / name).parent_path().lexically_normal().string());
+		}
+	}
+
+	path_id_t probe(const std::filesystem::path& dir, std::string_view name) {
+		if(track) {
+			watch(dir, name);
+		}
+		if(use_index) {
+			std::filesystem::path path;
+			switch(index.find(dir, name, path)) {
+			case dir_index_t::F_FOUND: return paths.intern(path.string());
+			case dir_index_t::F_NOT_FOUND: return no_path;
+			case dir_index_t::F_UNKNOWN: break;
+			}
+		}
+		std::error_code ec;
+		auto			candidate = dir / name;
+		++probes;
+		if(!std::filesystem::is_regular_file(candidate, ec)) {
+			return no_path;
+		}
+		++canonical;
+		auto result = std::filesystem::canonical(candidate, ec);
+		return ec ? no_path : paths.intern(result.string());
+	}
+};
+
+#endif // SINGLEINCLUDE_RESOLVER_HPP
@@ -0,0 +1,392 @@
+/**
+ * @file      scanner.hpp
+ * @brief     Directive scanner of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_SCANNER_HPP
+#define SINGLEINCLUDE_SCANNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SINGLEINCLUDE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+enum directive_kind_t : uint8_t {
+	D_NONE, // Not recorded
+	D_INCLUDE,
+	D_IF,
+	D_IFDEF,
+	D_IFNDEF,
+	D_ELIF,
+	D_ELIFDEF,
+	D_ELIFNDEF,
+	D_ELSE,
+	D_ENDIF,
+	D_DEFINE,
+	D_UNDEF,
+	D_PRAGMA,
+};
+
+struct include_directive_t {
+	std::string_view name; // Header name as written, e.g. sub/b.h
+	bool			 is_angle = false;
+};
+
+// Same characters as \s in the old std::regex (C locale)
+constexpr bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+inline unsigned count_trailing_zero(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Find the first '#' in [first, last), return last if not found
+inline const char* find_hash(const char* first, const char* last) {
+#if defined(__AVX2__)
+	const __m256i hash = _mm256_set1_epi8('#');
+	for(; last - first >= 32; first += 32) {
+		__m256i	 block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+		unsigned mask  = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, hash)));
+		if(mask) {
+			return first + count_trailing_zero(mask);
+		}
+	}
+#elif defined(SINGLEINCLUDE_SSE2)
+	const __m128i hash = _mm_set1_epi8('#');
+	for(; last - first >= 16; first += 16) {
+		__m128i	 block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+		unsigned mask  = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, hash)));
+		if(mask) {
+			return first + count_trailing_zero(mask);
+		}
+	}
+#endif
+	if(first == last) {
+		return last;
+	}
+	auto p = static_cast<const char*>(memchr(first, '#', last - first));
+	return p ? p : last;
+}
+
+/**
+ * @brief  Find the next line whose first non-space character is '#'
+ * @param  text The whole file
+ * @param  pos  Where to start, must be the beginning of a line
+ * @return The beginning of that line, or npos if there is no more directive
+ */
+inline size_t find_directive(std::string_view text, size_t pos) {
+	if(pos >= text.size()) {
+		return std::string_view::npos;
+	}
+	const char* begin = text.data();
+	const char* end	  = begin + text.size();
+	const char* p	  = begin + pos;
+	while((p = find_hash(p, end)) != end) {
+		const char* q = p;
+		while(q != begin + pos && q[-1] != '\n' && is_space(q[-1])) {
+			--q;
+		}
+		if(q == begin + pos || q[-1] == '\n') {
+			return q - begin;
+		}
+		++p;
+	}
+	return std::string_view::npos;
+}
+
+// Return the offset of the '\n' ending the line at pos, or text.size() for the last line
+inline size_t find_line_end(std::string_view text, size_t pos) {
+	if(pos >= text.size()) {
+		return text.size();
+	}
+	auto p = static_cast<const char*>(memchr(text.data() + pos, '\n', text.size() - pos));
+	return p ? p - text.data() : text.size();
+}
+
+/**
+ * @brief  Check whether line is an include directive
+ * @note   Accept exactly what ^\s*#\s*include\s*(<.*>|".*")\s*$ used to match
+ * @param  line One line without the trailing '\n'
+ * @param  inc  Filled with the header name and its form on success
+ */
+inline bool match_include(std::string_view line, include_directive_t& inc) {
+	size_t i = 0, n = line.size();
+	while(i < n && is_space(line[i])) {
+		++i;
+	}
+	if(i == n || line[i] != '#') {
+		return false;
+	}
+	++i;
+	while(i < n && is_space(line[i])) {
+		++i;
+	}
+	if(line.compare(i, 7, "include") != 0) {
+		return false;
+	}
+	i += 7;
+	while(i < n && is_space(line[i])) {
+		++i;
+	}
+	if(i == n || (line[i] != '<' && line[i] != '"')) {
+		return false;
+	}
+	bool is_angle = line[i] == '<';
+	while(n > i && is_space(line[n - 1])) {
+		--n;
+	}
+	if(n - i < 2 || line[n - 1] != (is_angle ? '>' : '"')) {
+		return false;
+	}
+	if(line.substr(i + 1, n - i - 2).find('\r') != std::string_view::npos) { // '.' never matches '\r'
+		return false;
+	}
+	size_t first = i + 1;
+	while(is_space(line[first])) {
+		++first;
+	}
+	size_t last = first;
+	while(line[last] != '>' && line[last] != '"' && !is_space(line[last])) {
+		++last;
+	}
+	inc.name	 = line.substr(first, last - first);
+	inc.is_angle = is_angle;
+	return true;
+}
+
+constexpr bool is_identifier(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/**
+ * @brief  Check whether line is a conditional, #define, #undef or #pragma directive
+ * @param  line One line without the trailing '\n'
+ * @param  arg  Set to what follows the keyword, without surrounding spaces
+ * @return D_NONE for any other line
+ */
+inline directive_kind_t match_conditional(std::string_view line, std::string_view& arg) {
+	size_t i = 0, n = line.size();
+	while(i < n && is_space(line[i])) {
+		++i;
+	}
+	if(i == n || line[i] != '#') {
+		return D_NONE;
+	}
+	++i;
+	while(i < n && is_space(line[i])) {
+		++i;
+	}
+	size_t word = i;
+	while(i < n && is_identifier(line[i])) {
+		++i;
+	}
+	constexpr std::pair<std::string_view, directive_kind_t> keywords[] = {
+		{ "if", D_IF },
+		{ "ifdef", D_IFDEF },
+		{ "ifndef", D_IFNDEF },
+		{ "elif", D_ELIF },
+		{ "elifdef", D_ELIFDEF },
+		{ "elifndef", D_ELIFNDEF },
+		{ "else", D_ELSE },
+		{ "endif", D_ENDIF },
+		{ "define", D_DEFINE },
+		{ "undef", D_UNDEF },
+		{ "pragma", D_PRAGMA },
+	};
+	directive_kind_t kind = D_NONE;
+	for(auto& [keyword, k] : keywords) {
+		if(line.substr(word, i - word) == keyword) {
+			kind = k;
+			break;
+		}
+	}
+	if(kind == D_NONE) {
+		return D_NONE;
+	}
+	while(i < n && is_space(line[i])) {
+		++i;
+	}
+	while(n > i && is_space(line[n - 1])) {
+		--n;
+	}
+	arg = line.substr(i, n - i);
+	return kind;
+}
+
+struct directive_line_t {
+	size_t				begin; // Offset of the line
+	size_t				end;   // Offset of the '\n' ending the line, or the size of the text
+	directive_kind_t	kind;
+	include_directive_t inc; // For other kinds than D_INCLUDE, inc.name is the argument of the directive
+};
+
+// Find all include, conditional, #define, #undef and #pragma directives of text, in order
+inline std::vector<directive_line_t> scan_directives(std::string_view text) {
+	std::vector<directive_line_t> result;
+	size_t						  scan = 0, begin;
+	while((begin = find_directive(text, scan)) != std::string_view::npos) {
+		size_t				end	 = find_line_end(text, begin);
+		std::string_view	line = text.substr(begin, end - begin);
+		include_directive_t inc;
+		if(match_include(line, inc)) {
+			result.push_back({ begin, end, D_INCLUDE, inc });
+		} else if(directive_kind_t kind = match_conditional(line, inc.name); kind != D_NONE) {
+			result.push_back({ begin, end, kind, inc });
+		}
+		scan = end + 1;
+	}
+	return result;
+}
+
+// Check whether text holds nothing but spaces and comments
+inline bool only_comments(std::string_view text) {
+	size_t i = 0;
+	while(i < text.size()) {
+		if(is_space(text[i])) {
+			++i;
+		} else if(text.compare(i, 2, "//") == 0) {
+			i = find_line_end(text, i);
+		} else if(text.compare(i, 2, "/*") == 0) {
+			size_t end = text.find("*/", i + 2);
+			if(end == std::string_view::npos) {
+				return false;
+			}
+			i = end + 2;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Get the identifier arg starts with, e.g. the name of a macro being defined
+inline std::string_view leading_identifier(std::string_view arg) {
+	size_t n = 0;
+	while(n < arg.size() && is_identifier(arg[n])) {
+		++n;
+	}
+	return arg.substr(0, n);
+}
+
+// Same as leading_identifier, if nothing but a comment follows it
+inline std::string_view sole_identifier(std::string_view arg) {
+	std::string_view name = leading_identifier(arg);
+	return only_comments(arg.substr(name.size())) ? name : std::string_view();
+}
+
+// Get the macro tested by #ifndef X, #if !defined(X) or #if !defined X
+inline std::string_view guard_macro(const directive_line_t& d) {
+	if(d.kind == D_IFNDEF) {
+		return sole_identifier(d.inc.name);
+	} else if(d.kind != D_IF) {
+		return {};
+	}
+	std::string_view arg = d.inc.name;
+	auto			 eat = [&](std::string_view token) {
+		size_t i = 0;
+		while(i < arg.size() && is_space(arg[i])) {
+			++i;
+		}
+		if(arg.compare(i, token.size(), token) != 0) {
+			return false;
+		}
+		arg.remove_prefix(i + token.size());
+		return true;
+	};
+	if(!eat("!") || !eat("defined") || (!arg.empty() && is_identifier(arg[0]))) {
+		return {};
+	}
+	bool paren = eat("(");
+	while(!arg.empty() && is_space(arg[0])) {
+		arg.remove_prefix(1);
+	}
+	std::string_view name = leading_identifier(arg);
+	arg.remove_prefix(name.size());
+	if(paren && !eat(")")) {
+		return {};
+	}
+	return only_comments(arg) ? name : std::string_view();
+}
+
+/**
+ * @brief  Find the include guard of a file, as the multiple-include optimisation of GCC does
+ * @note   The file must be a single #ifndef X (or #if !defined(X)) followed by
+ *         #define X, whose #endif ends the file, without #else or #elif.
+ *         Only spaces and comments may be outside.
+ * @return X, or an empty string if the file has no such guard
+ */
+inline std::string_view find_include_guard(std::string_view text, const std::vector<directive_line_t>& directives) {
+	if(directives.size() < 3 || directives.back().kind != D_ENDIF) {
+		return {};
+	}
+	auto&			 open  = directives.front();
+	auto&			 close = directives.back();
+	std::string_view name  = guard_macro(open);
+	if(name.empty() || directives[1].kind != D_DEFINE || leading_identifier(directives[1].inc.name) != name) {
+		return {};
+	}
+	if(!only_comments(text.substr(0, open.begin)) || (close.end < text.size() && !only_comments(text.substr(close.end)))) {
+		return {};
+	}
+	int depth = 0;
+	for(size_t i = 0; i < directives.size(); ++i) {
+		switch(directives[i].kind) {
+		case D_IF:
+		case D_IFDEF:
+		case D_IFNDEF: ++depth; break;
+		case D_ELIF:
+		case D_ELIFDEF:
+		case D_ELIFNDEF:
+		case D_ELSE:
+			if(depth == 1) {
+				return {};
+			}
+			break;
+		case D_ENDIF:
+			if(--depth == 0 && i + 1 != directives.size()) {
+				return {};
+			}
+			break;
+		default: break;
+		}
+	}
+	return depth == 0 ? name : std::string_view();
+}
+
+// Check whether the file has #pragma once outside any conditional
+inline bool has_pragma_once(const std::vector<directive_line_t>& directives) {
+	int depth = 0;
+	for(auto& d : directives) {
+		if(d.kind == D_IF || d.kind == D_IFDEF || d.kind == D_IFNDEF) {
+			++depth;
+		} else if(d.kind == D_ENDIF) {
+			--depth;
+		} else if(d.kind == D_PRAGMA && depth == 0 && sole_identifier(d.inc.name) == "once") {
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif // SINGLEINCLUDE_SCANNER_HPP
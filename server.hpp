@@ -0,0 +1,269 @@
+/**
+ * @file      server.hpp
+ * @brief     Local socket between a SingleInclude server and its clients
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_SERVER_HPP
+#define SINGLEINCLUDE_SERVER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32 // Unix-domain sockets, not available on Windows
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// What a client asks for: the command line to run, where, and where its output goes
+struct request_t {
+	std::string				 cwd;
+	std::vector<std::string> args; // Including the program name
+	int						 out = 1; // Descriptors of the client, passed along with the request
+	int						 err = 2;
+};
+
+// Address of the socket file, false if the name is too long
+inline bool local_address(const std::string& name, sockaddr_un& addr) {
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(name.empty() || name.size() >= sizeof(addr.sun_path)) {
+		return false;
+	}
+	std::memcpy(addr.sun_path, name.c_str(), name.size());
+	return true;
+}
+
+// Connected socket, -1 if nobody listens on name
+inline int connect_local(const std::string& name) {
+	sockaddr_un addr;
+	if(!local_address(name, addr)) {
+		return -1;
+	}
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+inline bool write_all(int fd, const char* data, size_t size) {
+	while(size > 0) {
+		ssize_t n = ::write(fd, data, size);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		} else if(n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= size_t(n);
+	}
+	return true;
+}
+
+inline bool read_all(int fd, char* data, size_t size) {
+	while(size > 0) {
+		ssize_t n = ::read(fd, data, size);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		} else if(n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= size_t(n);
+	}
+	return true;
+}
+
+/**
+ * @brief Send the request, its descriptors going with the size of its strings
+ * @note  The strings are the working directory then the arguments, each one
+ *        ended by a '\0'.
+ */
+inline bool send_request(int fd, const request_t& request) {
+	std::string payload = request.cwd + '\0';
+	for(auto& a : request.args) {
+		payload += a;
+		payload += '\0';
+	}
+	uint32_t size = static_cast<uint32_t>(payload.size());
+	iovec	 iov { &size, sizeof(size) };
+	int		 fds[2] = { request.out, request.err };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+	msghdr msg {};
+	msg.msg_iov		   = &iov;
+	msg.msg_iovlen	   = 1;
+	msg.msg_control	   = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr* c		   = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level	   = SOL_SOCKET;
+	c->cmsg_type	   = SCM_RIGHTS;
+	c->cmsg_len		   = CMSG_LEN(sizeof(fds));
+	std::memcpy(CMSG_DATA(c), fds, sizeof(fds));
+	if(::sendmsg(fd, &msg, 0) != ssize_t(sizeof(size))) {
+		return false;
+	}
+	return write_all(fd, payload.data(), payload.size());
+}
+
+// Receive a request, its descriptors are then owned by the caller
+inline bool receive_request(int fd, request_t& request) {
+	uint32_t size = 0;
+	iovec	 iov { &size, sizeof(size) };
+	int		 fds[2] = { -1, -1 };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+	msghdr msg {};
+	msg.msg_iov		   = &iov;
+	msg.msg_iovlen	   = 1;
+	msg.msg_control	   = control;
+	msg.msg_controllen = sizeof(control);
+	if(::recvmsg(fd, &msg, 0) != ssize_t(sizeof(size))) {
+		return false;
+	}
+	cmsghdr* c = CMSG_FIRSTHDR(&msg);
+	if(!c || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		return false;
+	}
+	std::memcpy(fds, CMSG_DATA(c), sizeof(fds));
+	request.out = fds[0];
+	request.err = fds[1];
+	std::string payload(size, '\0');
+	if(!read_all(fd, payload.data(), size)) {
+		return false;
+	}
+	request.args.clear();
+	for(size_t begin = 0, end; (end = payload.find('\0', begin)) != std::string::npos; begin = end + 1) {
+		request.args.emplace_back(payload, begin, end - begin);
+	}
+	if(request.args.empty()) {
+		return false;
+	}
+	request.cwd = std::move(request.args.front());
+	request.args.erase(request.args.begin());
+	return true;
+}
+
+inline bool send_status(int fd, int status) {
+	int32_t s = status;
+	return write_all(fd, reinterpret_cast<const char*>(&s), sizeof(s));
+}
+
+inline bool receive_status(int fd, int& status) {
+	int32_t s = 0;
+	if(!read_all(fd, reinterpret_cast<char*>(&s), sizeof(s))) {
+		return false;
+	}
+	status = s;
+	return true;
+}
+
+/**
+ * @brief Socket file on which a server accepts its clients, one at a time
+ * @note  A socket file left by a server which is gone is replaced, but not
+ *        one on which a server still listens, nor any other kind of file.
+ *        The file is removed with the listener.
+ */
+class local_listener_t {
+public:
+	explicit local_listener_t(std::string socket_name)
+		: name(std::move(socket_name)) { }
+	local_listener_t(const local_listener_t&) = delete;
+	local_listener_t& operator=(const local_listener_t&) = delete;
+	~local_listener_t() {
+		if(fd >= 0) {
+			::close(fd);
+			::unlink(name.c_str());
+		}
+	}
+
+	// Start listening, set error and return false on failure
+	bool listen(std::string& error) {
+		sockaddr_un addr;
+		if(!local_address(name, addr)) {
+			error = "Invalid socket name";
+			return false;
+		}
+		if(int other = connect_local(name); other >= 0) {
+			::close(other);
+			error = "A server is running already";
+			return false;
+		}
+		if(struct stat st; ::lstat(name.c_str(), &st) == 0) {
+			if(!S_ISSOCK(st.st_mode)) { // Not left by a server, so not ours to remove
+				error = "Not a socket";
+				return false;
+			}
+			::unlink(name.c_str());
+		}
+		fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 16) != 0) {
+			error = std::strerror(errno);
+			if(fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+			return false;
+		}
+		::signal(SIGPIPE, SIG_IGN); // A client gone makes writes fail instead
+		return true;
+	}
+
+	// Connection of the next client, -1 on failure
+	int accept() {
+		int client;
+		while((client = ::accept(fd, nullptr, nullptr)) < 0 && errno == EINTR) { }
+		return client;
+	}
+
+private:
+	std::string name;
+	int			fd = -1;
+};
+
+/**
+ * @brief Make the descriptors of a client stdout and stderr until the end of the scope
+ * @note  The streams must be flushed before both ends of the scope, as
+ *        their buffers do not know where their output goes.
+ */
+class redirect_t {
+public:
+	redirect_t(int out, int err)
+		: saved_out(::dup(1))
+		, saved_err(::dup(2)) {
+		::dup2(out, 1);
+		::dup2(err, 2);
+	}
+	redirect_t(const redirect_t&) = delete;
+	redirect_t& operator=(const redirect_t&) = delete;
+	~redirect_t() {
+		::dup2(saved_out, 1);
+		::dup2(saved_err, 2);
+		::close(saved_out);
+		::close(saved_err);
+	}
+
+private:
+	int saved_out;
+	int saved_err;
+};
+
+inline void close_fd(int fd) {
+	if(fd >= 0) {
+		::close(fd);
+	}
+}
+
+#endif // _WIN32
+
+#endif // SINGLEINCLUDE_SERVER_HPP
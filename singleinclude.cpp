@@ -0,0 +1,963 @@
+/**
+ * @file      singleinclude.cpp
+ * @brief     Expansion and output of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include "singleinclude.hpp"
+
+#if __has_include(<format.h>) // Provided by CMake
+#define FMT_HEADER_ONLY
+#include <format.h>
+using fmt::make_format_args;
+using fmt::vformat;
+#elif __has_include(<format>)
+#include <format>
+#elif __has_include(<fmt/format.h>)
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+using fmt::make_format_args;
+using fmt::vformat;
+#else
+#error SingleInclude must be compiled with eithor <format> in std library or an external fmtlib
+#endif
+using namespace std;
+namespace fs = filesystem;
+
+string error_state::what() {
+	return "Error: " + vformat(error_msg[e], make_format_args(w));
+}
+
+const string header = R"+(// This file is generated automatically by SingleInclude
+// It's suggested not to edit anything below
+// If you found any issue, please report to https://github.com/dragon-archer/SingleInclude/issues
+)+";
+
+// OUT.K.EXT, the k-th of several outputs named by OUT.EXT
+fs::path numbered_output(const fs::path& name, size_t k) {
+	fs::path result = name.parent_path() / name.stem();
+	result += "." + to_string(k) + name.extension().string();
+	return result;
+}
+
+// Which of n parts of [0, total) the offset middle falls in
+size_t part_of(size_t middle, size_t total, size_t n) {
+	return total ? min(n - 1, middle * n / total) : 0;
+}
+
+/**
+ * @brief Replace the targets by unity translation units of them
+ * @note  The ungrouped inputs are given in order to unity units by the middle
+ *        of their size, then each group makes a unit. Each unit expands its
+ *        inputs one after the other as a single target.
+ */
+void amalgamator_t::plan_unity(const list<string>& groups, const fs::path& output) {
+	vector<pair<string, vector<path_id_t>>> named; // Groups, in the order they are first given
+	vector<pair<path_id_t, size_t>>			batch; // Ungrouped inputs and their size
+	size_t									total = 0;
+	auto									given = groups.begin(); // Group of t
+	for(auto& t : targets) {
+		if(given->empty()) {
+			error_code ec;
+			size_t	   size = fs::file_size(paths.path(t.name), ec);
+			batch.emplace_back(t.name, ec ? 0 : size);
+			total += batch.back().second;
+		} else {
+			auto it = find_if(named.begin(), named.end(), [&](auto& g) { return g.first == *given; });
+			if(it == named.end()) {
+				it = named.insert(named.end(), { *given, {} });
+			}
+			it->second.push_back(t.name);
+		}
+		++given;
+	}
+	vector<vector<path_id_t>> units(min(options.unity, batch.size()));
+	size_t					  offset = 0;
+	for(auto& [name, size] : batch) {
+		units[part_of(offset + size / 2, total, units.size())].push_back(name);
+		offset += size;
+	}
+	units.erase(remove_if(units.begin(), units.end(), [](auto& u) { return u.empty(); }), units.end());
+	for(auto& g : named) {
+		units.push_back(move(g.second));
+	}
+	targets.clear();
+	for(auto& inputs : units) {
+		auto& t = targets.emplace_back(inputs.front());
+		for(auto name : inputs) {
+			t.sources.push_back(t.graph.intern(name, false));
+		}
+		if(!output.empty()) {
+			t.outfilename = units.size() == 1 ? output : numbered_output(output, targets.size());
+		}
+		log("Unity translation unit ", targets.size(), " has ", inputs.size(), " inputs");
+	}
+}
+
+void prefetch_includes(amalgamator_t& config, path_id_t name, bool is_angle, const source_t& source);
+
+// Open and scan the file the first time any target needs it
+source_t* load_source(amalgamator_t& config, path_id_t name, bool is_angle) {
+	source_t* source;
+	{
+		lock_guard<mutex> lock(config.sources_mutex);
+		auto&			  slot = config.sources[name];
+		if(!slot) {
+			slot = make_unique<source_t>();
+		}
+		source = slot.get();
+	}
+	call_once(source->loaded, [&] {
+		int64_t begin = config.tracer.enabled() ? wall_ns() : 0;
+		bool	opened;
+		{
+			phase_scope_t scope(config.stats, P_READ);
+			opened = source->file.open(config.paths.path(name));
+		}
+		if(opened) {
+			phase_scope_t scope(config.stats, P_SCAN);
+			if(config.stats.enabled) {
+				++config.stats.files_opened;
+				config.stats.bytes_read += source->file.text().size();
+			}
+			if(config.cacheDir.empty()) {
+				source->directives = scan_directives(source->file.text());
+			} else if(string key(config.paths.str(name)); !config.cache.find(key, source->file, source->directives)) {
+				source->directives = scan_directives(source->file.text());
+				config.cache.store(key, source->file, source->directives);
+			}
+			source->guard = find_include_guard(source->file.text(), source->directives);
+			source->once  = has_pragma_once(source->directives);
+			source->ok	  = true;
+		}
+		if(config.tracer.enabled()) {
+			config.tracer.complete("load " + config.paths.path(name).filename().string(), begin,
+							"\"path\":\"" + json_escape(config.paths.str(name)) + "\",\"bytes\":" + to_string(source->file.text().size()));
+		}
+		if(source->ok && config.prefetcher.enabled()) {
+			prefetch_includes(config, name, is_angle, *source);
+		}
+	});
+	return source->ok ? source : nullptr;
+}
+
+/**
+ * @brief Start reading the files included by name, as soon as it is scanned
+ * @note  Each file is queued once. It is resolved as parse_include would do
+ *        it, which then finds the file loaded or waits for the load in
+ *        progress in load_source. The output does not change.
+ */
+void prefetch_includes(amalgamator_t& config, path_id_t name, bool is_angle, const source_t& source) {
+	path_id_t current_path = is_angle ? no_path : config.paths.parent(name);
+	for(auto& i : source.directives) {
+		if(i.kind != D_INCLUDE) {
+			continue;
+		}
+		path_id_t found;
+		{
+			phase_scope_t scope(config.stats, P_RESOLVE);
+			found = config.resolver.resolve(config.includePaths, current_path, i.inc.name);
+		}
+		if(found == no_path) {
+			continue;
+		}
+		{
+			lock_guard<mutex> lock(config.sources_mutex);
+			auto&			  slot = config.sources[found];
+			if(slot) { // Loaded or queued already
+				continue;
+			}
+			slot = make_unique<source_t>();
+		}
+		config.prefetcher.push([&config, found, angle = i.inc.is_angle] {
+			load_source(config, found, angle);
+		});
+	}
+}
+
+/**
+ * @brief Check whether an included file would be empty, as its guard is defined
+ * @note  Used with --all, where files are expanded again unless they are
+ *        guarded by #pragma once or an include guard which is still defined.
+ *        Only the expansions outside of any conditional count, as the others
+ *        may be left out by the compiler.
+ */
+bool guarded(amalgamator_t& config, target_t& target, path_id_t name) {
+	source_t* source = load_source(config, name, false);
+	return source && ((source->once && target.keptFiles.contains(name)) || (!source->guard.empty() && target.guards.count(source->guard)));
+}
+
+// Expand the file of node id into out, via is the edge expanding it, if any
+error_state parse_include(amalgamator_t& config, target_t& target, uint32_t id, output_t& out, unsigned depth = 0, edge_t* via = nullptr) {
+	const path_id_t name	 = target.graph.node(id).name; // Copied, as nodes move when the graph grows
+	const bool		is_angle = target.graph.node(id).is_angle;
+	const int64_t	begin	 = config.tracer.enabled() ? wall_ns() : 0;
+	int64_t			resolving = 0; // Time spent in resolve, when traced
+	source_t*		source	  = load_source(config, name, is_angle);
+	if(!source) {
+		return { E_FILE_ERROR, "Cannot open file " + string(config.paths.str(name)) };
+	}
+	target.includedFiles.insert(name);
+	if(target.conditionals == 0) { // Otherwise the file may be left out by the compiler, and its guard not defined
+		target.keptFiles.insert(name);
+		if(!source->guard.empty()) {
+			target.guards.insert(source->guard);
+		}
+	}
+	if(config.stats.enabled) {
+		config.stats.depth(depth);
+	}
+	string_view	   text			= source->file.text();
+	path_id_t	   current_path = no_path;
+	vector<edge_t> edges;
+	if(!is_angle) {
+		current_path = config.paths.parent(name);
+		config.log("Add current path to search: ", config.paths.str(current_path));
+	}
+	strip_state_t lexer;	 // Only used with --strip-comments
+	size_t		  units = 0; // Units of the root seen so far
+	auto		  left_out = [&](size_t unit) { // The unit belongs to another shard than the one generated
+		 return depth == 0 && unit < target.unitCount && (unit < target.firstUnit || unit >= target.lastUnit);
+	};
+	auto emit = [&](string_view s) { // Text of the file
+		if(units > 0 && left_out(units)) { // What follows a unit belongs to the next one
+			return;
+		}
+		if(config.options.strip_comments) {
+			target.stripper.feed(lexer, s, out);
+		} else {
+			out.append(s);
+		}
+	};
+	auto mark = [&](string_view prefix, string_view line, string_view suffix) { // Comment added around an include
+		if(!config.options.strip_comments) {
+			out.append(prefix);
+			out.append(line);
+			out.append(suffix);
+		}
+	};
+	branch_stack_t branches; // Only used with -D or -U
+	unsigned	   opened = 0; // Conditionals of this file around the current line
+	size_t		   pos	  = 0; // Everything before pos has been written to out, unless in a dropped branch
+	for(auto& [begin, end, kind, inc] : source->directives) {
+		string_view line = text.substr(begin, end - begin);
+		if(kind != D_INCLUDE) {
+			if(kind == D_UNDEF && branches.live()) { // The file of that guard would be expanded again
+				target.guards.erase(leading_identifier(inc.name));
+			}
+			bool			live   = branches.live();
+			branch_action_t action = target.macros.enabled() ? branches.step(kind, inc.name, target.macros) : B_KEEP;
+			if(!(!source->guard.empty() && (begin == source->directives.front().begin || begin == source->directives.back().begin))) { // The include guard does not count
+				if((action == B_KEEP && (kind == D_IF || kind == D_IFDEF || kind == D_IFNDEF)) || action == B_REOPEN) {
+					++opened;
+					++target.conditionals;
+				} else if(action == B_KEEP && kind == D_ENDIF && opened > 0) {
+					--opened;
+					--target.conditionals;
+				}
+			}
+			if(action != B_KEEP) {
+				if(live) {
+					emit(text.substr(pos, begin - pos));
+				}
+				pos = end + 1;
+				if(action == B_REOPEN) { // The branches before have been dropped
+					emit(kind == D_ELIF ? "#if " : kind == D_ELIFDEF ? "#ifdef " : "#ifndef ");
+					emit(inc.name);
+					emit("\n");
+				}
+			}
+			continue;
+		} else if(!branches.live()) {
+			config.log("Ignore include file ", quoted_t { inc.name, inc.is_angle }, " in a dropped branch");
+			continue;
+		}
+		emit(text.substr(pos, begin - pos));
+		pos = end + 1;
+		if(config.options.strip_comments && lexer.mode != S_CODE) { // Not a directive, and the text of the file would become code
+			config.log("Ignore include file ", quoted_t { inc.name, inc.is_angle }, " in a comment or a literal");
+			emit(line);
+			emit("\n");
+			continue;
+		}
+		edge_t edge;
+		edge.is_angle = inc.is_angle;
+		config.log("Found include file ", quoted_t { inc.name, edge.is_angle });
+		path_id_t found;
+		{
+			phase_scope_t scope(config.stats, P_RESOLVE);
+			int64_t		  resolve_begin = config.tracer.enabled() ? wall_ns() : 0;
+			found						= config.resolver.resolve(config.includePaths, current_path, inc.name);
+			if(config.tracer.enabled()) {
+				resolving += wall_ns() - resolve_begin;
+			}
+		}
+		// Units are the files included by the root outside of any conditional, the root is cut between them
+		bool unit = depth == 0 && found != no_path && opened == 0;
+		if(unit ? left_out(units) : units > 0 && left_out(units)) {
+			config.log("Leave include file ", quoted_t { inc.name, edge.is_angle }, " to another shard");
+			units += unit;
+			continue;
+		}
+		if(unit && units == target.firstUnit) {
+			target.unitBounds.push_back(out.size());
+		}
+		if(found == no_path) {
+			config.log("Ignore include file ", quoted_t { inc.name, edge.is_angle }, " because of not found (may be system header)");
+			edge.node  = target.graph.intern(config.paths.intern(inc.name), edge.is_angle, false);
+			edge.state = I_NOT_FOUND;
+			if(config.options.hoist && edge.is_angle && target.conditionals == 0 && config.noHoist.find(inc.name) == config.noHoist.end()) {
+				if(target.hoisted.insert(inc.name).second) {
+					config.log("Move include file ", quoted_t { inc.name, edge.is_angle }, " to the preamble");
+					target.preamble.push_back(inc.name);
+				}
+			} else {
+				emit(line);
+				emit("\n");
+			}
+		} else {
+			edge.node = target.graph.intern(found, edge.is_angle);
+			config.log("Include file expends to ", config.paths.str(found));
+			// Outside of conditionals, a file only expanded inside some does not count, as it may be left out
+			bool included = target.conditionals > 0 ? target.includedFiles.contains(found) : target.keptFiles.contains(found);
+			if(included && (!config.options.include_all || guarded(config, target, found))) {
+				config.log("Include file already exists, ignore");
+				edge.state = I_ALREADY_INCLUDED;
+				mark("// ", line, " (omitted because it has been expended)\n");
+			} else {
+				edge.state = I_EXPENDED;
+				mark("// ", line, "\n");
+				if(auto err = parse_include(config, target, edge.node, out, depth + 1, &edge); err != E_NO_ERROR) {
+					return err;
+				}
+				mark("// End ", line, "\n");
+			}
+		}
+		edges.push_back(edge);
+		if(unit) {
+			++units;
+			target.unitBounds.push_back(out.size());
+		}
+	}
+	uint32_t expansion = target.graph.add_expansion(id, edges);
+	if(via) {
+		via->expansion = expansion;
+	}
+	if(pos <= text.size() && branches.live()) { // Every line is terminated by '\n', including the last one
+		emit(text.substr(pos));
+		emit("\n");
+	}
+	target.conditionals -= opened; // Not closed in this file
+	if(config.tracer.enabled()) { // Nested in the span of the includer, as it is on the same thread
+		config.tracer.complete(config.paths.path(name).filename().string(), begin,
+						"\"path\":\"" + json_escape(config.paths.str(name)) + "\",\"bytes\":" + to_string(text.size())
+							+ ",\"lines\":" + to_string(count(text.begin(), text.end(), '\n') + !text.empty())
+							+ ",\"resolve_us\":" + to_string(resolving / 1000) + ",\"depth\":" + to_string(depth));
+	}
+	return E_NO_ERROR;
+}
+
+// Expand the root of target, or each of its inputs in turn for a unity translation unit
+error_state expand_root(amalgamator_t& config, target_t& target, output_t& out) {
+	if(target.sources.empty()) {
+		return parse_include(config, target, 0, out);
+	}
+	for(auto id : target.sources) {
+		string_view name = config.paths.str(target.graph.node(id).name);
+		if(target.includedFiles.contains(target.graph.node(id).name)) { // Included by an input before
+			config.log("Input file already exists, ignore: ", name);
+			if(!config.options.strip_comments) {
+				for(string_view piece : { string_view("// Input \""), name, string_view("\" (omitted because it has been expended)\n") }) {
+					out.append(piece);
+				}
+			}
+			continue;
+		}
+		if(!config.options.strip_comments) {
+			for(string_view piece : { string_view("// Input \""), name, string_view("\"\n") }) {
+				out.append(piece);
+			}
+		}
+		if(auto error = parse_include(config, target, id, out); error != E_NO_ERROR) {
+			return error;
+		}
+	}
+	return E_NO_ERROR;
+}
+
+void amalgamator_t::reset() {
+	prefetcher.stop();
+	options = options_t();
+	includePaths.clear();
+	macros = macro_table_t();
+	keepComments.clear();
+	noHoist.clear();
+	cacheDir.clear();
+	stats.reset();
+	tracer.close();
+	targets.clear();
+	resolver.use_index = false;
+	resolver.hits = resolver.misses = resolver.probes = resolver.negative = resolver.canonical = 0;
+	resolver.index.listed = resolver.index.entries = 0;
+	cache.hits = cache.misses = 0;
+}
+
+void amalgamator_t::refresh() {
+	prefetcher.drain(); // Its jobs may hold sources
+	for(auto it = sources.begin(); it != sources.end();) {
+		auto& file = it->second->file;
+		if(!it->second->ok || !file.id().valid() || !(file_id_of(paths.path(it->first)) == file.id())) {
+			log("Read again: ", paths.str(it->first));
+			it = sources.erase(it);
+		} else {
+			++it;
+		}
+	}
+	error_code	   ec;
+	vector<string> dirs { fs::current_path(ec).string() }; // Relative names depend on it
+	for(auto& p : includePaths) {
+		dirs.push_back(p.string());
+	}
+	bool valid = dirs == resolvedFor;
+	for(auto it = resolvedDirs.begin(); valid && it != resolvedDirs.end(); ++it) {
+		valid = dir_stamp(it->first) == it->second;
+	}
+	if(!valid && !resolvedFor.empty()) {
+		log("Include paths or directories have changed, resolve again");
+	}
+	if(!valid) {
+		resolver.clear();
+		resolvedDirs.clear();
+		resolvedFor = move(dirs);
+	}
+}
+
+void amalgamator_t::remember_dirs() {
+	for(auto& dir : resolver.watched) {
+		resolvedDirs.try_emplace(dir, dir_stamp(dir));
+	}
+}
+
+vector<path_id_t> amalgamator_t::sorted_files(const target_t& target) const {
+	vector<pair<fs::path, path_id_t>> files;
+	for(auto id : target.includedFiles.ids()) {
+		files.emplace_back(paths.path(id), id);
+	}
+	sort(files.begin(), files.end());
+	vector<path_id_t> result;
+	for(auto& f : files) {
+		result.push_back(f.second);
+	}
+	return result;
+}
+
+void amalgamator_t::load_cache() {
+	refresh(); // So what is preloaded is not dropped by the refresh of the run
+	if(!cache.load(cacheDir / scan_cache_t::file_name)) {
+		log("No usable scan cache in ", cacheDir.string());
+		return;
+	}
+	vector<string> dirs;
+	for(auto& p : includePaths) {
+		dirs.push_back(p.string());
+	}
+	if(!cache.resolutions_valid(dirs)) {
+		log("Include paths or directories have changed, resolve again");
+		return;
+	}
+	for(auto& [key, result] : cache.resolutions) {
+		string_view k	 = key;
+		size_t		zero = k.find('\0');
+		if(zero != string_view::npos) {
+			resolver.preload(k.substr(0, zero), k.substr(zero + 1), result ? optional<string_view>(*result) : nullopt);
+		}
+	}
+	for(auto& [dir, stamp] : cache.dirs) {
+		resolver.watched.insert(dir);
+		resolvedDirs.try_emplace(dir, stamp);
+	}
+}
+
+void amalgamator_t::save_cache() {
+	cache.include_paths.clear();
+	for(auto& p : includePaths) {
+		cache.include_paths.push_back(p.string());
+	}
+	cache.dirs.clear();
+	for(auto& dir : resolver.watched) {
+		cache.dirs.emplace(dir, dir_stamp(dir));
+	}
+	cache.resolutions.clear();
+	resolver.for_each([&](path_id_t dir, string_view name, path_id_t result) {
+		string key(dir == no_path ? string_view() : paths.str(dir));
+		key += '\0';
+		key += name;
+		cache.resolutions.emplace_back(move(key), result == no_path ? nullopt : optional<string>(paths.str(result)));
+	});
+	if(!cache.save(cacheDir / scan_cache_t::file_name)) {
+		log("Cannot write the scan cache to ", cacheDir.string());
+	}
+}
+
+// A new file beside target, renamed over it by commit() and removed if not committed
+class temp_output_t {
+public:
+	fs::path name;
+#ifdef _WIN32
+	ofstream stream;
+#else
+	int fd = -1;
+#endif
+
+	temp_output_t() = default;
+	temp_output_t(const temp_output_t&) = delete;
+	temp_output_t& operator=(const temp_output_t&) = delete;
+	~temp_output_t() {
+		discard();
+	}
+
+	error_state open(const fs::path& target_name) {
+		static atomic<unsigned> counter { 0 };
+		target = target_name;
+#ifdef _WIN32
+		name = target;
+		name += ".tmp" + to_string(counter++);
+		stream.open(name);
+		if(!stream.is_open()) {
+			return { E_FILE_ERROR, "Cannot open output file: " + name.string() };
+		}
+#else
+		while(fd < 0) {
+			name = target;
+			name += ".tmp" + to_string(getpid()) + "." + to_string(counter++);
+			fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+			if(fd < 0 && errno != EEXIST) {
+				return { E_FILE_ERROR, "Cannot open output file: " + name.string() };
+			}
+		}
+		struct stat st;
+		if(stat(target.c_str(), &st) == 0) { // Keep the mode of the file replaced
+			fchmod(fd, st.st_mode & 07777);
+		}
+#endif
+		return E_NO_ERROR;
+	}
+
+	// Finish writing, the file stays until commit() or discard()
+	error_state close() {
+#ifdef _WIN32
+		if(stream.is_open()) {
+			stream.close();
+			if(!stream) {
+				return { E_FILE_ERROR, "Cannot write output file: " + name.string() };
+			}
+		}
+#else
+		if(fd >= 0) {
+			int result = ::close(fd);
+			fd		   = -1;
+			if(result != 0) {
+				return { E_FILE_ERROR, "Cannot write output file: " + name.string() };
+			}
+		}
+#endif
+		return E_NO_ERROR;
+	}
+
+	error_state commit() {
+		if(auto error = close(); error != E_NO_ERROR) {
+			return error;
+		}
+		error_code ec;
+		fs::rename(name, target, ec);
+		if(ec) {
+			return { E_FILE_ERROR, "Cannot replace output file: " + target.string() };
+		}
+		name.clear();
+		return E_NO_ERROR;
+	}
+
+	void discard() {
+		close();
+		if(!name.empty()) {
+			error_code ec;
+			fs::remove(name, ec);
+			name.clear();
+		}
+	}
+
+private:
+	fs::path target;
+};
+
+// Write content to a new file beside outfilename, then rename it over outfilename
+error_state replace_output(const output_t& content, const fs::path& outfilename) {
+	temp_output_t temp;
+	if(auto error = temp.open(outfilename); error != E_NO_ERROR) {
+		return error;
+	}
+#ifdef _WIN32
+	content.write(temp.stream);
+#else
+	if(!content.write(temp.fd)) {
+		return { E_FILE_ERROR, "Cannot write output file: " + temp.name.string() };
+	}
+#endif
+	return temp.commit();
+}
+
+error_state write_output(const amalgamator_t& config, const output_t& content, const fs::path& outfilename) {
+	if(outfilename.empty()) {
+#ifdef _WIN32
+		content.write(cout);
+#else
+		if(!content.write(STDOUT_FILENO)) {
+			return { E_FILE_ERROR, "Cannot write to stdout" };
+		}
+#endif
+		return E_NO_ERROR;
+	}
+	if(config.options.if_changed) {
+		source_file_t old;
+		if(old.open(outfilename) && content.equals(old.text())) {
+			config.log("Output file is unchanged: ", outfilename.string());
+			return E_NO_ERROR;
+		}
+		return replace_output(content, outfilename);
+	}
+#ifdef _WIN32
+	ofstream fout;
+	fout.open(outfilename);
+	if(!fout.is_open()) {
+		return { E_FILE_ERROR, "Cannot open output file: " + outfilename.string() };
+	}
+	content.write(fout);
+	fout.close();
+#else
+	int fd = open(outfilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(fd < 0) {
+		return { E_FILE_ERROR, "Cannot open output file: " + outfilename.string() };
+	}
+	bool ok = content.write(fd);
+	if(close(fd) != 0 || !ok) {
+		return { E_FILE_ERROR, "Cannot write output file: " + outfilename.string() };
+	}
+#endif
+	return E_NO_ERROR;
+}
+
+// Escape name for the Makefile syntax, which ninja reads too
+string make_escape(const string& name) {
+	string s;
+	for(size_t i = 0; i < name.size(); ++i) {
+		char c = name[i];
+		if(c == ' ' || c == '\t') {
+			for(size_t j = i; j > 0 && name[j - 1] == '\\'; --j) { // Backslashes before a space are doubled
+				s += '\\';
+			}
+			s += '\\';
+		} else if(c == '$') {
+			s += '$';
+		} else if(c == '#') {
+			s += '\\';
+		}
+		s += c;
+	}
+	return s;
+}
+
+/**
+ * @brief Add the rule of target to out
+ * @param phony Headers having a phony rule already. Such a rule is added for
+ *              every other one, so that deleting a header is not an error
+ */
+void add_depfile_rule(output_t& out, const amalgamator_t& config, const target_t& target, path_set_t& phony) {
+	auto files = config.sorted_files(target);
+	if(target.shardNames.empty()) {
+		out.append_copy(make_escape(target.outfilename.string()) + ":");
+	} else { // Each shard depends on every file, as any of them may move to another shard
+		for(size_t i = 0; i < target.shardNames.size(); ++i) {
+			out.append_copy((i ? " " : "") + make_escape(target.shardNames[i].string()));
+		}
+		out.append(":");
+	}
+	out.append_copy(" \\\n  " + make_escape(string(config.paths.str(target.name))));
+	for(auto f : files) {
+		if(f != target.name) {
+			out.append_copy(" \\\n  " + make_escape(string(config.paths.str(f))));
+		}
+	}
+	out.append("\n");
+	for(auto f : files) {
+		if(f != target.name && phony.insert(f)) {
+			out.append_copy("\n" + make_escape(string(config.paths.str(f))) + ":\n");
+		}
+	}
+}
+
+error_state amalgamator_t::write_depfiles(bool per_output, const fs::path& shared) {
+	if(per_output) {
+		for(auto& t : targets) {
+			output_t   deps;
+			path_set_t phony;
+			add_depfile_rule(deps, *this, t, phony);
+			fs::path name = t.outfilename;
+			name += ".d";
+			if(auto error = replace_output(deps, name); error != E_NO_ERROR) {
+				return error;
+			}
+		}
+	}
+	if(!shared.empty()) {
+		output_t   deps;
+		path_set_t phony;
+		for(auto& t : targets) {
+			add_depfile_rule(deps, *this, t, phony);
+		}
+		return replace_output(deps, shared);
+	}
+	return E_NO_ERROR;
+}
+
+// Whether the file name has exactly the content of the file temp
+bool same_content(const fs::path& temp, const fs::path& name) {
+	source_file_t a, b;
+	return a.open(temp) && b.open(name) && a.text() == b.text();
+}
+
+// Write the header, then the whole target, after its preamble with --hoist
+error_state expand_target(amalgamator_t& config, target_t& target, output_t& out) {
+	target.macros = config.macros;
+	if(config.options.strip_comments) {
+		target.stripper = comment_stripper_t(config.keepComments);
+	}
+	out.append(header);
+	size_t preamble = 0;
+	if(config.options.hoist && config.options.streaming) { // The preamble is written first, so find it by an expansion which is dropped
+		target_t probe(target.name);
+		output_t dropped;
+		dropped.discard();
+		probe.macros	= config.macros;
+		probe.unitCount = target.unitCount;
+		probe.firstUnit = target.firstUnit;
+		probe.lastUnit	= target.lastUnit;
+		for(auto id : target.sources) {
+			probe.sources.push_back(probe.graph.intern(target.graph.node(id).name, false));
+		}
+		if(auto error = expand_root(config, probe, dropped); error != E_NO_ERROR) {
+			return error;
+		}
+		for(auto name : probe.preamble) {
+			for(string_view piece : { string_view("#include <"), name, string_view(">\n") }) {
+				out.append(piece);
+			}
+		}
+		target.hoisted = move(probe.hoisted); // So they are not written again
+	} else if(config.options.hoist) {
+		preamble = out.mark();
+	}
+	if(auto error = expand_root(config, target, out); error != E_NO_ERROR) {
+		return error;
+	}
+	if(config.options.hoist && !config.options.streaming) {
+		vector<string_view> pieces;
+		pieces.reserve(target.preamble.size() * 3);
+		for(auto name : target.preamble) {
+			pieces.insert(pieces.end(), { string_view("#include <"), name, string_view(">\n") });
+		}
+		out.insert(preamble, pieces);
+	}
+	if(config.options.strip_comments) {
+		target.stripper.finish(out);
+		if(config.stats.enabled) {
+			config.stats.bytes_stripped += target.stripper.removed();
+		}
+	}
+	return E_NO_ERROR;
+}
+
+// Write target while expanding it, so the output is never held in memory
+error_state generate_stream(amalgamator_t& config, target_t& target) {
+	output_t	  content;
+	temp_output_t temp;
+	if(config.options.dry_run) {
+		content.discard();
+	} else if(target.outfilename.empty()) {
+#ifdef _WIN32
+		content.stream_to(&cout);
+#else
+		content.stream_to(STDOUT_FILENO);
+#endif
+	} else {
+		if(auto error = temp.open(target.outfilename); error != E_NO_ERROR) {
+			return error;
+		}
+#ifdef _WIN32
+		content.stream_to(&temp.stream);
+#else
+		content.stream_to(temp.fd);
+#endif
+	}
+	{
+		phase_scope_t scope(config.stats, P_EMIT); // Includes writing, which is done on the way
+		if(auto error = expand_target(config, target, content); error != E_NO_ERROR) {
+			return error; // The temporary file is removed
+		}
+		if(!content.flush()) {
+			return { E_FILE_ERROR, target.outfilename.empty() ? "Cannot write to stdout" : "Cannot write output file: " + temp.name.string() };
+		}
+	}
+	if(!config.options.dry_run && config.stats.enabled) {
+		config.stats.bytes_written += content.size();
+	}
+	if(config.options.dry_run || target.outfilename.empty()) {
+		return E_NO_ERROR;
+	}
+	if(config.options.if_changed) {
+		if(auto error = temp.close(); error != E_NO_ERROR) {
+			return error;
+		}
+		if(same_content(temp.name, target.outfilename)) {
+			config.log("Output file is unchanged: ", target.outfilename.string());
+			return E_NO_ERROR;
+		}
+	}
+	return temp.commit();
+}
+
+error_state generate(amalgamator_t& config, target_t& target) {
+	if(config.options.streaming) {
+		return generate_stream(config, target);
+	}
+	output_t content;
+	{
+		phase_scope_t scope(config.stats, P_EMIT);
+		if(auto error = expand_target(config, target, content); error != E_NO_ERROR) {
+			return error;
+		}
+	}
+	if(!config.options.dry_run) {
+		phase_scope_t scope(config.stats, P_WRITE);
+		if(config.stats.enabled) {
+			config.stats.bytes_written += content.size();
+		}
+		return write_output(config, content, target.outfilename);
+	}
+	return E_NO_ERROR;
+}
+
+/**
+ * @brief Write target as shards of about the same size
+ * @note  The root is measured once, by an expansion which is dropped, and
+ *        each shard is given the units whose middle falls in its share.
+ *        Each shard is then expanded on its own, as it expands again the
+ *        files its units need. The target keeps the files of all shards.
+ */
+error_state generate_shards(amalgamator_t& config, target_t& target) {
+	target_t whole(target.name);
+	{
+		phase_scope_t scope(config.stats, P_EMIT);
+		output_t	  dropped;
+		dropped.discard();
+		whole.macros	= config.macros;
+		whole.unitCount = SIZE_MAX;
+		whole.lastUnit	= SIZE_MAX;
+		if(auto error = parse_include(config, whole, 0, dropped); error != E_NO_ERROR) {
+			return error;
+		}
+	}
+	auto&  bounds = whole.unitBounds; // Before the first unit, then after each one
+	size_t units  = bounds.empty() ? 0 : bounds.size() - 1;
+	size_t total  = units ? bounds.back() - bounds.front() : 0;
+	size_t next	  = 0; // First unit of the shard
+	for(unsigned k = 0; k < config.options.shards; ++k) {
+		target_t shard(target.name);
+		shard.unitCount = units;
+		shard.firstUnit = next;
+		while(next < units && part_of((bounds[next] + bounds[next + 1]) / 2 - bounds.front(), total, config.options.shards) == k) {
+			++next;
+		}
+		shard.lastUnit	  = next;
+		shard.outfilename = numbered_output(target.outfilename, k + 1);
+		config.log("Shard ", k + 1, " has units ", shard.firstUnit, " to ", shard.lastUnit, ", written to ", shard.outfilename.string());
+		if(auto error = generate(config, shard); error != E_NO_ERROR) {
+			return error;
+		}
+		for(auto id : shard.includedFiles.ids()) {
+			target.includedFiles.insert(id);
+		}
+		target.shardNames.push_back(shard.outfilename);
+		target.shardGraphs.push_back(move(shard.graph));
+	}
+	return E_NO_ERROR;
+}
+
+/**
+ * @brief Generate every target on up to jobs threads
+ * @note  Each target is still expanded depth-first by a single thread, so its
+ *        output does not depend on jobs. Once a target fails, no other target
+ *        is started.
+ */
+vector<error_state> amalgamator_t::generate_all() {
+	refresh();
+	vector<target_t*> queue;
+	for(auto& t : targets) {
+		queue.push_back(&t);
+	}
+	if(prefetcher.enabled()) {
+		for(auto t : queue) {
+			prefetcher.push([this, name = t->name] {
+				load_source(*this, name, false);
+			});
+		}
+	}
+	vector<error_state> errors(queue.size(), E_FINISH); // E_FINISH: not generated
+	atomic<size_t>		next { 0 };
+	atomic<bool>		failed { false };
+	auto				worker = [&] {
+		size_t i;
+		while(!failed && (i = next++) < queue.size()) {
+			errors[i] = options.shards > 1 ? generate_shards(*this, *queue[i]) : generate(*this, *queue[i]);
+			if(errors[i] != E_NO_ERROR) {
+				failed = true;
+			}
+		}
+	};
+	vector<thread> pool;
+	for(size_t i = 1; i < min(options.jobs, queue.size()); ++i) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for(auto& t : pool) {
+		t.join();
+	}
+	prefetcher.drain(); // Jobs of includes never reached may still run, and update what is saved
+	remember_dirs();
+	return errors;
+}
+
+error_state amalgamator_t::amalgamate(const fs::path& input, result_t& result) {
+	error_code ec;
+	fs::path   name = fs::canonical(input, ec);
+	if(ec || !fs::is_regular_file(name)) {
+		return { E_FILE_NOT_EXIST, input.string() };
+	}
+	refresh();
+	target_t target(paths.intern(name.string()));
+	{
+		phase_scope_t scope(stats, P_EMIT);
+		if(auto error = expand_target(*this, target, result.output); error != E_NO_ERROR) {
+			return error;
+		}
+	}
+	prefetcher.drain();
+	remember_dirs();
+	result.graph = move(target.graph);
+	result.files = sorted_files(target);
+	return E_NO_ERROR;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file      singleinclude.hpp
+ * @brief     Library of SingleInclude, used by the command line and embeddable in other programs
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_SINGLEINCLUDE_HPP
+#define SINGLEINCLUDE_SINGLEINCLUDE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "cache.hpp"
+#include "conditional.hpp"
+#include "graph.hpp"
+#include "output.hpp"
+#include "paths.hpp"
+#include "prefetch.hpp"
+#include "reader.hpp"
+#include "resolver.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+#include "strip.hpp"
+#include "trace.hpp"
+
+enum error_type : int {
+	E_NO_ERROR = 0,
+	E_TOO_LESS_ARGUMENTS,
+	E_FILE_NOT_EXIST,
+	E_DIR_NOT_EXIST,
+	E_UNKNOWN_OPTION,
+	E_TOO_MANY_INPUT,
+	E_FILE_ERROR,
+	E_TOO_MANY_OUTPUT,
+	E_NO_OUTPUT,
+	E_BAD_ARGUMENT,
+	E_FINISH,
+	ERROR_COUNT
+};
+
+constexpr const char* error_msg[ERROR_COUNT] = {
+	"No error occured",
+	"Too less arguments",
+	"{}: File doesn't exist",
+	"{}: Directory doesn't exist",
+	"Unkown option {}",
+	"Too many input file",
+	"File error: {}",
+	"Too many output file",
+	"{}: No output file given for this input",
+	"{}: Invalid argument",
+	"Finished"
+};
+
+struct error_state {
+	error_type	e;
+	std::string w;
+	error_state(error_type error = E_NO_ERROR, std::string what = "")
+		: e(error)
+		, w(what) { }
+
+	operator error_type() {
+		return e;
+	}
+
+	std::string what();
+};
+
+constexpr const char* include_msg[INCLUDE_STATE_COUNT] = {
+	"expended",
+	"already included",
+	"not found"
+};
+
+// How the inputs are expanded and written, set by the command line options
+struct options_t {
+	bool   include_all	  = false; // -a
+	bool   verbose		  = false; // -v, log to stderr
+	bool   dry_run		  = false; // -d, nothing is written
+	bool   if_changed	  = false;
+	bool   streaming	  = false;
+	bool   strip_comments = false;
+	bool   hoist		  = false;
+	size_t jobs			  = 1;
+	size_t shards		  = 1;
+	size_t unity		  = 0; // Unity translation units for the ungrouped inputs, 0 if not in unity mode
+};
+
+// One input file and everything generated from it
+struct target_t {
+	path_id_t							name;
+	include_graph_t						graph; // The root is name
+	std::filesystem::path				outfilename;
+	path_set_t							includedFiles;
+	macro_table_t						macros; // Known while expanding, starts as given by -D and -U
+	std::unordered_set<std::string_view> guards; // Include guards defined so far outside of conditionals, used with --all
+	path_set_t							keptFiles; // Files expanded so far outside of conditionals, the others may be left out by the compiler
+	comment_stripper_t					stripper; // Used with --strip-comments
+	unsigned							conditionals = 0; // Conditionals kept around the line being expanded
+	std::unordered_set<std::string_view> hoisted;	  // Header names moved to the preamble
+	std::vector<std::string_view>		preamble;		  // The same, in the order they were found
+	std::vector<size_t>					unitBounds;		  // Output size before the first unit of the root expanded, then after each unit
+	size_t								unitCount = 0;	  // Units of the root when generating a shard, 0 otherwise
+	size_t								firstUnit = 0;	  // Units of the shard being generated, the others are left out
+	size_t								lastUnit  = 0;
+	std::vector<std::filesystem::path> shardNames;	// Outputs written instead of outfilename, with --shards
+	std::vector<include_graph_t>		shardGraphs; // Graph of each shard, the graph of the target being unused then
+	std::vector<uint32_t>				sources;	   // Nodes of the inputs of a unity translation unit, the first being the root
+
+	target_t(path_id_t p)
+		: name(p) {
+		graph.intern(p, false);
+	}
+};
+
+// Scanned once, then shared by all targets
+struct source_t {
+	source_file_t					file;
+	std::vector<directive_line_t>	directives;
+	std::string_view				guard; // Macro of the include guard, empty if none
+	bool							once = false; // Has #pragma once
+	std::once_flag					loaded;
+	bool							ok = false;
+};
+
+struct quoted_t {
+	std::string_view name;
+	bool			 is_angle;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const quoted_t& q) {
+	constexpr const char* begin_quote[2] = { "\"", "<" };
+	constexpr const char* end_quote[2]	 = { "\"", ">" };
+
+	return os << begin_quote[q.is_angle] << q.name << end_quote[q.is_angle];
+}
+
+// What amalgamate() gives for one input
+struct result_t {
+	include_graph_t		   graph;  // Node 0 is the input, names are ids of the paths of the amalgamator
+	output_t			   output; // Views of the files read, valid until the next run of the amalgamator
+	std::vector<path_id_t> files;  // Files expanded, in the order of their path
+};
+
+/**
+ * @brief Options, include paths and caches of SingleInclude, shared by every run
+ * @note  Files are read, scanned and resolved once per amalgamator, so the
+ *        next runs find them warm, unless they have changed on disk since.
+ *        It is neither copyable nor movable, as the outputs and the workers
+ *        refer to it.
+ */
+class amalgamator_t {
+public:
+	options_t													options;
+	std::list<std::filesystem::path>							includePaths;
+	macro_table_t												macros;
+	std::vector<std::string>									keepComments; // Comments containing any of them are not stripped
+	std::set<std::string, std::less<>>							noHoist;	  // Angle includes left where they are
+	std::filesystem::path										cacheDir;	  // Empty if the scan cache is not used
+	stats_t														stats;
+	tracer_t													tracer;
+	std::list<target_t>											targets; // Inputs of generate_all()
+	// Caches
+	path_table_t												paths; // Before anything holding ids
+	resolver_t													resolver { paths };
+	std::unordered_map<path_id_t, std::unique_ptr<source_t>>	sources; // Referenced by the outputs, so keep them alive
+	std::mutex													sources_mutex;
+	scan_cache_t												cache;
+	prefetcher_t												prefetcher; // Last, so its jobs are stopped before the rest is destroyed
+
+	amalgamator_t() {
+		resolver.track = true; // So refresh() knows which directories to check
+	}
+	amalgamator_t(const amalgamator_t&) = delete;
+	amalgamator_t& operator=(const amalgamator_t&) = delete;
+
+	// Expand input into result, in memory, with the options set
+	error_state amalgamate(const std::filesystem::path& input, result_t& result);
+
+	/**
+	 * @brief Replace the targets by unity translation units of them, with --unity
+	 * @param groups The n-th is the group of the n-th target, empty if none
+	 * @param output Name the units are numbered after, empty if they are not written
+	 */
+	void plan_unity(const std::list<std::string>& groups, const std::filesystem::path& output);
+
+	// Generate every target to its output file, return the error of each one
+	std::vector<error_state> generate_all();
+
+	// Write the dependency files of the targets generated: OUT.d beside each output OUT if per_output, and shared for all of them if not empty
+	error_state write_depfiles(bool per_output, const std::filesystem::path& shared);
+
+	// Make the answers of the last run available, if nothing they depend on has changed
+	void load_cache();
+	void save_cache();
+
+	// Set everything but the caches back to its default, before the options of another run
+	void reset();
+
+	/**
+	 * @brief Forget what has changed on disk since the last run
+	 * @note  Files whose identity (inode, size, mtime) has changed are read
+	 *        again. The resolutions are all dropped if the include paths or
+	 *        the working directory are not the same, or if a directory they
+	 *        depend on has been modified.
+	 *        Called at the start of amalgamate() and generate_all().
+	 */
+	void refresh();
+
+	// Included files of target, in the order of their path
+	std::vector<path_id_t> sorted_files(const target_t& target) const;
+
+	// Build the message only if it is printed
+	template<typename... T>
+	void log(const T&... msg) const {
+		if(options.verbose) {
+			std::lock_guard<std::mutex> lock(log_mutex);
+			(std::cerr << ... << msg) << std::endl;
+		}
+	}
+
+private:
+	mutable std::mutex				log_mutex;
+	std::vector<std::string>		resolvedFor;  // Working directory and include paths of the resolutions
+	std::map<std::string, int64_t>	resolvedDirs; // Directories they depend on and their dir_stamp, at the end of the last run
+
+	void remember_dirs();
+};
+
+#endif // SINGLEINCLUDE_SINGLEINCLUDE_HPP
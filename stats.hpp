@@ -0,0 +1,141 @@
+/**
+ * @file      stats.hpp
+ * @brief     Statistics of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_STATS_HPP
+#define SINGLEINCLUDE_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+enum phase_t : int {
+	P_OPTIONS,
+	P_READ,
+	P_SCAN,
+	P_RESOLVE,
+	P_EMIT,
+	P_WRITE,
+	PHASE_COUNT
+};
+
+constexpr const char* phase_names[PHASE_COUNT] = {
+	"options",
+	"read",
+	"scan",
+	"resolve",
+	"emit",
+	"write"
+};
+
+inline int64_t wall_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time used by the calling thread
+inline int64_t thread_cpu_ns() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if(!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		return 0;
+	}
+	auto ticks = [](const FILETIME& t) { return (int64_t(t.dwHighDateTime) << 32 | t.dwLowDateTime) * 100; };
+	return ticks(kernel) + ticks(user);
+#else
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Counters of one run, only updated when enabled
+ * @note  Everything is atomic, as workers and I/O threads update them
+ *        concurrently. Phase times add up over all threads.
+ */
+struct stats_t {
+	bool				  enabled = false;
+	std::atomic<int64_t>  wall[PHASE_COUNT] {};
+	std::atomic<int64_t>  cpu[PHASE_COUNT] {};
+	std::atomic<uint64_t> files_opened { 0 };
+	std::atomic<uint64_t> bytes_read { 0 };
+	std::atomic<uint64_t> bytes_written { 0 };
+	std::atomic<uint64_t> bytes_stripped { 0 }; // Removed by --strip-comments
+	std::atomic<uint64_t> max_depth { 0 };
+
+	// Start counting again, for another run
+	void reset() {
+		enabled = false;
+		for(int p = 0; p < PHASE_COUNT; ++p) {
+			wall[p] = 0;
+			cpu[p]	= 0;
+		}
+		files_opened   = 0;
+		bytes_read	   = 0;
+		bytes_written  = 0;
+		bytes_stripped = 0;
+		max_depth	   = 0;
+	}
+
+	void depth(uint64_t d) {
+		uint64_t m = max_depth;
+		while(d > m && !max_depth.compare_exchange_weak(m, d)) { }
+	}
+};
+
+/**
+ * @brief Add the time spent until the end of the scope to a phase
+ * @note  Scopes may nest on a thread: the time of the inner ones is only
+ *        counted in their own phase, not in the enclosing one.
+ */
+class phase_scope_t {
+public:
+	phase_scope_t(stats_t& s, phase_t p)
+		: stats(s.enabled ? &s : nullptr)
+		, phase(p) {
+		if(stats) {
+			wall_start	 = wall_ns();
+			cpu_start	 = thread_cpu_ns();
+			nested_wall0 = nested_wall;
+			nested_cpu0	 = nested_cpu;
+		}
+	}
+	phase_scope_t(const phase_scope_t&) = delete;
+	phase_scope_t& operator=(const phase_scope_t&) = delete;
+
+	~phase_scope_t() {
+		if(stats) {
+			int64_t wall = wall_ns() - wall_start;
+			int64_t cpu	 = thread_cpu_ns() - cpu_start;
+			stats->wall[phase] += wall - (nested_wall - nested_wall0);
+			stats->cpu[phase] += cpu - (nested_cpu - nested_cpu0);
+			nested_wall = nested_wall0 + wall;
+			nested_cpu	= nested_cpu0 + cpu;
+		}
+	}
+
+private:
+	static inline thread_local int64_t nested_wall = 0; // Time of the scopes ended on this thread
+	static inline thread_local int64_t nested_cpu  = 0;
+
+	stats_t* stats;
+	phase_t	 phase;
+	int64_t	 wall_start	  = 0;
+	int64_t	 cpu_start	  = 0;
+	int64_t	 nested_wall0 = 0;
+	int64_t	 nested_cpu0  = 0;
+};
+
+#endif // SINGLEINCLUDE_STATS_HPP
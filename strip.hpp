@@ -0,0 +1,256 @@
+/**
+ * @file      strip.hpp
+ * @brief     Comment stripping of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_STRIP_HPP
+#define SINGLEINCLUDE_STRIP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "output.hpp"
+#include "scanner.hpp"
+
+enum strip_mode_t : uint8_t {
+	S_CODE,
+	S_LINE_COMMENT,
+	S_BLOCK_COMMENT,
+	S_STRING,
+	S_CHAR,
+	S_RAW_STRING,
+};
+
+// Lexer state of one file, kept from one piece of its text to the next
+struct strip_state_t {
+	strip_mode_t mode = S_CODE;
+	bool		 keep = false; // The comment being read is kept
+	bool		 glue = false; // A removed block comment follows a token, so it may have to become a space
+	std::string	 raw_end;	   // )delimiter" ending the raw string being read
+};
+
+/**
+ * @brief Remove the comments of the text fed, and collapse runs of blank lines
+ * @note  Strings, raw strings, character literals and line continuations are
+ *        understood, so nothing in them is taken for a comment. A removed
+ *        block comment becomes a space where it separates two tokens.
+ *        Comments containing one of the keep strings are left untouched.
+ *        The text is written as views of what is fed, so it must outlive
+ *        the output. Lines are buffered until their end, fed by any file.
+ */
+class comment_stripper_t {
+public:
+	comment_stripper_t() = default;
+	explicit comment_stripper_t(std::vector<std::string> keep_comments)
+		: keep(std::move(keep_comments)) { }
+
+	void feed(strip_state_t& state, std::string_view text, output_t& out) {
+		fed += text.size();
+		size_t i = 0, n = text.size();
+		size_t piece = 0; // Start of what is kept but not in line yet
+		while(i < n) {
+			char c = text[i];
+			switch(state.mode) {
+			case S_CODE: {
+				if(c == '\n') {
+					add(text.substr(piece, i - piece));
+					end_line(text.substr(i, 1), out);
+					piece = ++i;
+				} else if(c == '/' && i + 1 < n && (text[i + 1] == '/' || text[i + 1] == '*')) {
+					bool   block = text[i + 1] == '*';
+					size_t end	 = block ? text.find("*/", i + 2) : find_line_end(text, i);
+					state.mode	 = block ? S_BLOCK_COMMENT : S_LINE_COMMENT;
+					state.keep	 = kept(text.substr(i, end == std::string_view::npos ? n - i : end - i));
+					if(!state.keep) {
+						add(text.substr(piece, i - piece));
+						state.glue = i > 0 ? !is_space(text[i - 1]) : !line.empty() && !line.back().empty() && !is_space(line.back().back());
+						line_cut   = true;
+					}
+					i += 2;
+				} else if(c == '"') {
+					line_text = true;
+					state.mode = raw_string(text, i, state.raw_end) ? S_RAW_STRING : S_STRING;
+					++i;
+				} else if(c == '\'' && !digit_separator(text, i)) {
+					line_text  = true;
+					state.mode = S_CHAR;
+					++i;
+				} else {
+					line_text |= !is_space(c);
+					++i;
+				}
+				break;
+			}
+			case S_LINE_COMMENT: {
+				if(c == '\n' && !continued(text, i)) { // The '\n' is read again as code
+					state.mode = S_CODE;
+					if(!state.keep) {
+						piece = i;
+					}
+				} else {
+					line_text |= state.keep;
+					++i;
+				}
+				break;
+			}
+			case S_BLOCK_COMMENT: {
+				size_t end = text.find("*/", i);
+				i		   = end == std::string_view::npos ? n : end + 2;
+				if(end == std::string_view::npos) {
+					break;
+				}
+				state.mode = S_CODE;
+				line_text |= state.keep;
+				if(!state.keep) {
+					piece = i;
+					if(state.glue && i < n && !is_space(text[i])) {
+						add(" ");
+					}
+				}
+				break;
+			}
+			case S_STRING:
+			case S_CHAR: {
+				if(c == '\\') {
+					i += 2;
+				} else if(c == '\n') { // Not terminated, stop there
+					state.mode = S_CODE;
+				} else {
+					state.mode = c == (state.mode == S_STRING ? '"' : '\'') ? S_CODE : state.mode;
+					++i;
+				}
+				break;
+			}
+			case S_RAW_STRING: {
+				size_t end = text.find(state.raw_end, i);
+				i		   = end == std::string_view::npos ? n : end + state.raw_end.size();
+				state.mode = end == std::string_view::npos ? S_RAW_STRING : S_CODE;
+				break;
+			}
+			}
+		}
+		bool removing = (state.mode == S_LINE_COMMENT || state.mode == S_BLOCK_COMMENT) && !state.keep;
+		if(!removing) {
+			add(text.substr(piece, std::min(i, n) - piece));
+		}
+	}
+
+	// Write the line which is not terminated yet, if any
+	void finish(output_t& out) {
+		if(!line.empty()) {
+			end_line({}, out);
+		}
+	}
+
+	// Number of bytes fed but not written
+	size_t removed() const {
+		return fed - written;
+	}
+
+private:
+	std::vector<std::string>	  keep;
+	std::vector<std::string_view> line;				 // Pieces of the current line
+	bool						  line_text = false; // The line holds anything but spaces
+	bool						  line_cut	= false; // Something has been removed from the line
+	bool						  blank		= false; // The last line written is blank
+	size_t						  fed		= 0;
+	size_t						  written	= 0;
+
+	bool kept(std::string_view comment) const {
+		for(auto& k : keep) {
+			if(comment.find(k) != std::string_view::npos) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void add(std::string_view s) {
+		if(!s.empty()) {
+			line.push_back(s);
+		}
+	}
+
+	void end_line(std::string_view newline, output_t& out) {
+		if(line_text) {
+			if(line_cut) { // Drop the spaces left before a comment, unless they follow a '\'
+				auto trimmed = line;
+				while(!trimmed.empty()) {
+					auto& last = trimmed.back();
+					while(!last.empty() && is_space(last.back())) {
+						last.remove_suffix(1);
+					}
+					if(!last.empty()) {
+						break;
+					}
+					trimmed.pop_back();
+				}
+				if(!trimmed.empty() && trimmed.back().back() != '\\') {
+					line = std::move(trimmed);
+				}
+			}
+			for(auto& s : line) {
+				out.append(s);
+				written += s.size();
+			}
+			blank = false;
+		} else if(blank) {
+			newline = {};
+		} else {
+			blank = true;
+		}
+		out.append(newline);
+		written += newline.size();
+		line.clear();
+		line_text = false;
+		line_cut  = false;
+	}
+
+	// Check whether the '\n' at i ends a line continued by a '\'
+	static bool continued(std::string_view text, size_t i) {
+		if(i > 0 && text[i - 1] == '\r') {
+			--i;
+		}
+		return i > 0 && text[i - 1] == '\\';
+	}
+
+	// Check whether the '\'' at i is a digit separator, as in 1'000'000
+	static bool digit_separator(std::string_view text, size_t i) {
+		size_t j = i;
+		while(j > 0 && (is_identifier(text[j - 1]) || text[j - 1] == '.' || text[j - 1] == '\'')) {
+			--j;
+		}
+		return j < i && ((text[j] >= '0' && text[j] <= '9') || text[j] == '.');
+	}
+
+	// Check whether the '"' at i starts a raw string, set end to what ends it
+	static bool raw_string(std::string_view text, size_t i, std::string& end) {
+		size_t j = i;
+		while(j > 0 && is_identifier(text[j - 1])) {
+			--j;
+		}
+		std::string_view prefix = text.substr(j, i - j);
+		if(prefix != "R" && prefix != "u8R" && prefix != "uR" && prefix != "UR" && prefix != "LR") {
+			return false;
+		}
+		size_t open = text.find('(', i + 1);
+		if(open == std::string_view::npos || open - i - 1 > 16) {
+			return false;
+		}
+		std::string_view delimiter = text.substr(i + 1, open - i - 1);
+		for(char c : delimiter) {
+			if(is_space(c) || c == '\\' || c == ')' || c == '"') {
+				return false;
+			}
+		}
+		end = ")" + std::string(delimiter) + "\"";
+		return true;
+	}
+};
+
+#endif // SINGLEINCLUDE_STRIP_HPP
@@ -0,0 +1,123 @@
+/**
+ * @file      trace.hpp
+ * @brief     Trace-event timeline of SingleInclude
+ * @version   1.1
+ * @author    dragon-archer (dragon-archer@outlook.com)
+ * @copyright Copyright (c) 2022
+ */
+#ifndef SINGLEINCLUDE_TRACE_HPP
+#define SINGLEINCLUDE_TRACE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "stats.hpp"
+
+// Escape s to be put between double quotes in JSON
+inline std::string json_escape(std::string_view s) {
+	std::string result;
+	result.reserve(s.size());
+	for(char c : s) {
+		switch(c) {
+		case '"': result += "\\\""; break;
+		case '\\': result += "\\\\"; break;
+		case '\n': result += "\\n"; break;
+		case '\t': result += "\\t"; break;
+		default:
+			if(static_cast<unsigned char>(c) < 0x20) {
+				char buf[8];
+				std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+				result += buf;
+			} else {
+				result += c;
+			}
+		}
+	}
+	return result;
+}
+
+/**
+ * @brief Spans of a run, written as Chrome trace-event JSON
+ * @note  Perfetto and chrome://tracing nest the spans of one thread by their
+ *        times, so nothing but the start and duration is recorded. Each
+ *        thread gets its own track, numbered in the order they are first seen.
+ */
+class tracer_t {
+public:
+	bool enabled() const {
+		return !file.empty();
+	}
+
+	void open(const std::filesystem::path& name) {
+		file  = name;
+		start = wall_ns();
+		tid(); // The main thread is the first track
+	}
+
+	// Disable and forget every span recorded, for another run
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		file.clear();
+		events.clear();
+		threads.clear();
+	}
+
+	// Record a span which started at begin (a wall_ns() time) and ends now
+	void complete(std::string_view name, int64_t begin, std::string args) {
+		int64_t						end = wall_ns();
+		uint32_t					t	= tid();
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back({ std::string(name), std::move(args), begin - start, end - begin, t });
+	}
+
+	// Write every span recorded, return false on failure
+	bool write() {
+		std::ofstream fout(file, std::ios::binary | std::ios::trunc);
+		if(!fout.is_open()) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		fout << "{\"traceEvents\":[\n";
+		for(uint32_t i = 0; i < threads.size(); ++i) {
+			fout << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\""
+				 << (i == 0 ? "main" : "thread " + std::to_string(i)) << "\"}},\n";
+		}
+		for(auto& e : events) {
+			fout << "{\"name\":\"" << json_escape(e.name) << "\",\"cat\":\"singleinclude\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+				 << ",\"ts\":" << e.begin / 1000 << "." << e.begin / 100 % 10 << e.begin / 10 % 10 << e.begin % 10
+				 << ",\"dur\":" << e.dur / 1000 << "." << e.dur / 100 % 10 << e.dur / 10 % 10 << e.dur % 10
+				 << ",\"args\":{" << e.args << "}},\n";
+		}
+		fout << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"singleinclude\"}}\n]}\n";
+		return fout.good();
+	}
+
+private:
+	struct event_t {
+		std::string name;
+		std::string args; // Members of a JSON object, without braces
+		int64_t		begin;
+		int64_t		dur;
+		uint32_t	tid;
+	};
+
+	std::filesystem::path							   file; // Empty if disabled
+	int64_t											   start = 0;
+	std::vector<event_t>							   events;
+	std::unordered_map<std::thread::id, uint32_t> threads;
+	std::mutex										   mutex;
+
+	uint32_t tid() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return threads.try_emplace(std::this_thread::get_id(), static_cast<uint32_t>(threads.size())).first->second;
+	}
+};
+
+#endif // SINGLEINCLUDE_TRACE_HPP